@@ -9,12 +9,12 @@
 #include "interpreted_args.hh"
 #include "error.hh"
 
-template <typename T>
+template <typename T, typename R=void>
 struct function_map {
   using type = T;
-  using function_type = std::function<void(T)>;
+  using function_type = std::function<R(T)>;
   using string_view = boost::string_view;
-  virtual void operator()(T) const = 0;
+  virtual R operator()(T) const = 0;
   static function_type make(string_view name, string_view arg_str) {
     try {
       return (*all.at(name))(arg_str);
@@ -35,16 +35,12 @@ struct canvas {
   inline TCanvas& operator* () noexcept { return *c; }
   inline TCanvas* operator->() noexcept { return  c; }
 
-  bool operator()(const std::vector<expression>& exprs, shared_str& group);
+  bool operator()(const program& prog, shared_str& group);
 
   void draw();
 };
 
 template <> class applicator<canvas>: public applicator<hist> {
-  canvas& c;
-
-  virtual bool hook(const expression& expr, int level);
-
 public:
   applicator(canvas& c, hist& h, shared_str& group);
 };
@@ -0,0 +1,27 @@
+#ifndef IVANP_HED_DAEMON_HH
+#define IVANP_HED_DAEMON_HH
+
+#include <string>
+
+class TFile;
+
+// hed's main, sets the output file name
+using hed_main = int(int argc, char* argv[], std::string& ofname);
+
+// Serve requests on a Unix socket from a process with ROOT initialized.
+// A request is the client's working directory followed by the arguments,
+// each terminated by '\0'. Every request is run in a forked process,
+// with stdout and stderr going to the client, followed by
+// '\0', the exit status, a space, and the output file name.
+// Requests are served one at a time, because forked processes share
+// the file offsets of the cached input files.
+int serve(const char* socket_path, hed_main* run);
+
+// Input file opened by the daemon before the request was forked, or null
+// if the file isn't cached or was modified since.
+// Files that aren't cached need to be passed to note_input,
+// so that the daemon opens them for subsequent requests.
+TFile* cached_input(const char* name);
+void note_input(const char* name);
+
+#endif
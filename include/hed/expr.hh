@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <functional>
+#include <memory>
 #include <iosfwd>
 
 #include <boost/regex.hpp>
@@ -37,11 +38,20 @@ class canvas;
 struct expression: flags {
   boost::regex re;
   shared_str sub;
+  std::string fcn; // function call, for printing
 
-  enum { none_tag, exprs_tag, hist_fcn_tag, canv_fcn_tag } tag = none_tag;
+  // results of operator() for repeated input strings
+  struct cache_t;
+  std::unique_ptr<cache_t> cache;
+  static constexpr size_t cache_max = 1<<12; // cleared when full
+
+  enum {
+    none_tag, exprs_tag, hist_fcn_tag, hist_pred_tag, canv_fcn_tag
+  } tag = none_tag;
   union {
     std::vector<expression> exprs;
     std::function<void(TH1*)> hist_fcn;
+    std::function<bool(TH1*)> hist_pred; // drops histogram if false
     std::function<void(canvas&)> canv_fcn;
   };
 
@@ -53,7 +63,56 @@ struct expression: flags {
   ~expression();
 
   static bool parse_canv;
+  static bool threaded; // lock result caches, set by scan_parallel
+  static bool quiet; // no p flag or verbose output, when reapplied
+
+private:
+  shared_str apply(const shared_str&) const; // uncached operator()
+
+public:
+  // plain select on a field: no substitution, subexpressions or functions
+  bool is_plain_select() const noexcept;
 };
 
+// Expressions lowered into a flat sequence of instructions.
+// Subexpressions are inlined after the instructions of their parent,
+// which skip past them when the parent doesn't match.
+// Instructions refer to the expressions, which must outlive the program.
+struct program {
+  struct instr {
+    enum op_t : unsigned char {
+      match,    // apply regex, skip if not matched or reject if selecting
+      concat,   // prepend or append the result to the target field
+      set,      // push the result onto the target field
+      call,     // histogram function
+      pred,     // histogram predicate, reject if false
+      canv_call // canvas function
+    } op;
+    unsigned char level; // nesting level, for printing
+    unsigned skip; // index of the next instruction if not matched
+    const expression* expr;
+  };
+  std::vector<instr> code;
+
+  program() = default;
+  program(const std::vector<expression>& exprs) { compile(exprs,0); }
+  inline bool empty() const noexcept { return code.empty(); }
+
+private:
+  void compile(const std::vector<expression>& exprs, unsigned level);
+};
+std::ostream& operator<<(std::ostream&, const program&);
+
+// Print cache hits and misses for expressions with regexes
+void print_cache_stats(
+  std::ostream&, const std::vector<expression>&, int level=0);
+
+// Whether any of the expressions or subexpressions is a predicate
+bool has_predicates(const std::vector<expression>& exprs);
+
+// Replace leading plain selections on the same field with one expression
+// using a combined regex. Returns the number of merged expressions.
+unsigned merge_selections(std::vector<expression>& exprs);
+
 #endif
 
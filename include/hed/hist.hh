@@ -3,35 +3,70 @@
 
 #include <array>
 #include <vector>
+#include <memory>
+#include <functional>
 
 #include <TH1.h>
 #include <TAxis.h>
 
+#include "tkey.hh"
 #include "shared_str.hh"
 #include "hed/expr.hh"
+#include "hed/timing.hh"
+#include "hed/summary.hh"
+
+// Remove a histogram from histograms collected for batch plugins
+void forget_batches(const TH1* h);
+
+// Delete a histogram with everything cached about it
+inline void delete_hist(TH1* h) {
+  forget_summary(h);
+  forget_batches(h);
+  delete h;
+}
 
 struct hist {
-  std::string init_impl(flags::field field);
+  void init_impl(flags::field field, std::string& str);
   inline shared_str init(flags::field field) {
-    return make_shared_str(init_impl(field));
+    shared_str str = shared_str_pool::local().get();
+    init_impl(field,*str);
+    return str;
   }
 
   TH1 *h;
+  TKey *key = nullptr; // h is read from key only when needed
   shared_str legend;
 
   hist(TH1* h) noexcept : h(h) { }
+  hist(TKey* key) noexcept : h(nullptr), key(key) { }
   hist(TH1* h, shared_str l) noexcept : h(h), legend(l) { }
   hist(const hist&) = delete;
   hist(hist&& o) noexcept
-  : h(o.h), legend(std::move(o.legend)) { o.h = nullptr; }
+  : h(o.h), key(o.key), legend(std::move(o.legend)) { o.h = nullptr; }
   ~hist() noexcept { }
   hist& operator=(const hist&) = delete;
   hist& operator=(hist&& o) noexcept {
     h = o.h;
+    key = o.key;
     legend = std::move(o.legend);
     o.h = nullptr;
     return *this;
   }
+
+  inline TH1* get() {
+    if (!h) {
+      timer t(timer::read);
+      h = read_key<TH1>(*key);
+    }
+    return h;
+  }
+  // free histogram that can be read again from its key
+  inline void release() {
+    if (h && key) {
+      delete_hist(h);
+      h = nullptr;
+    }
+  }
   inline hist clone(const std::string& name) {
     return { static_cast<TH1*>(h->Clone(name.c_str())), legend };
   }
@@ -41,7 +76,7 @@ struct hist {
   inline const TH1& operator* () const noexcept { return *h; }
   inline const TH1* operator->() const noexcept { return  h; }
 
-  bool operator()(const std::vector<expression>& exprs, shared_str& group);
+  bool operator()(const program& prog, shared_str& group);
 
 }; // end hist
 
@@ -52,19 +87,41 @@ protected:
   hist& h;
   shared_str& group;
 
-  std::array<std::vector<shared_str>,flags::nfields> fields;
-  inline auto& at(flags::field f) noexcept { return fields[f-1]; }
+  using field_history = std::array<std::vector<shared_str>,flags::nfields>;
+  std::unique_ptr<field_history> fields; // reused between histograms
+  static thread_local std::vector<std::unique_ptr<field_history>> free_fields;
+  inline auto& at(flags::field f) noexcept { return (*fields)[f-1]; }
 
-  virtual bool hook(const expression& expr, int level);
+  canvas* canv = nullptr; // target of canvas functions
 
   shared_str& init_field(flags::field q, int i);
 
 public:
   applicator(hist& h, shared_str& group);
+  ~applicator();
+
+  // First pass of the bounded memory mode only determines groups.
+  // Selected histograms are not read or modified,
+  // and functions are called only if predicates may depend on them.
+  static bool planning, plan_fcns;
 
-  bool operator()(const std::vector<expression>& exprs, int level=0);
+  bool operator()(const program& prog);
 };
 
+// Plugins with a run_batch(TH1**,size_t) entry point only collect
+// histograms passed to load. run_batches calls each of them once,
+// with its collected histograms in the order in which they appear in hs.
+void run_batches(const std::vector<TH1*>& hs);
+// Discard collected histograms, e.g. after they have been released
+void drop_batches();
+
+// Changes of ROOT globals, such as gStyle, made by hist functions.
+// While scanning on several threads they are queued with the index of
+// the scan task, and apply_globals() makes them in the order of tasks.
+void set_global(std::function<void()> f);
+void apply_globals();
+extern thread_local size_t scan_task_index;
+
 void divide(TH1*,TH1*,bool);
 void multiply(TH1*,TH1*);
 void hadd(TH1*,TH1*,double);
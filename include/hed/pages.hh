@@ -0,0 +1,34 @@
+#ifndef IVANP_HED_PAGES_HH
+#define IVANP_HED_PAGES_HH
+
+#include <string>
+#include <vector>
+#include <functional>
+
+struct page {
+  std::string file, title;
+};
+
+// Temporary directory next to the output file for single page files
+class page_dir {
+  std::string _path;
+public:
+  page_dir(const std::string& ofname);
+  ~page_dir(); // removes the directory with all files in it
+  page_dir(const page_dir&) = delete;
+  inline const std::string& path() const noexcept { return _path; }
+  std::string file(unsigned i) const; // name of the file for page i
+};
+
+// Draw pages in njobs forked processes, each page into its own file.
+// draw(i,title) prints page i and returns false if it is skipped.
+// Returns titles of drawn pages, indexed by i.
+// With njobs < 2 pages are drawn in this process.
+std::vector<std::pair<bool,std::string>> fork_pages(
+  unsigned npages, unsigned njobs,
+  const std::function<bool(unsigned,std::string&)>& draw);
+
+// Concatenate single page pdf files, with outline entries for the titles
+void assemble_pdf(const std::string& ofname, const std::vector<page>& pages);
+
+#endif
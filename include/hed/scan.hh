@@ -0,0 +1,80 @@
+#ifndef IVANP_HED_SCAN_HH
+#define IVANP_HED_SCAN_HH
+
+#include <vector>
+#include <memory>
+#include <utility>
+
+#include <TFile.h>
+#include <TDirectory.h>
+
+#include "tkey.hh"
+#include "shared_str.hh"
+#include "hed/expr.hh"
+#include "hed/hist.hh"
+#include "hed/timing.hh"
+
+template <typename F>
+void scan(TDirectory* dir, const program& prog, F& add);
+
+// Directory that is already in memory, e.g. read by the daemon,
+// or else read from its key
+inline TDirectory* read_dir(TKey& key) {
+  TObject* obj = key.GetMotherDir()->GetList()->FindObject(key.GetName());
+  if (obj && obj->InheritsFrom(TDirectory::Class()))
+    return static_cast<TDirectory*>(obj);
+  timer t(timer::read);
+  return read_key<TDirectory>(key);
+}
+
+template <typename F>
+void scan_key(TKey& key, const program& prog, F& add) {
+  const TClass* key_class = get_class(key);
+
+  if (key_class->InheritsFrom(TH1::Class())) { // HIST
+
+    hist h(&key); // read only if needed by expressions or selected
+    shared_str group;
+
+    { timer t(timer::exprs);
+      if ( !h(prog,group) ) { // free if read for expressions
+        h.release();
+        return;
+      }
+    }
+    // add hist if it passes selection
+    if (applicator<hist>::planning) h.release(); // read again when drawn
+    timer t(timer::group);
+    add(std::move(group),std::move(h));
+
+  } else if (key_class->InheritsFrom(TDirectory::Class())) { // DIR
+    scan(read_dir(key),prog,add);
+  }
+}
+
+template <typename F>
+void scan(TDirectory* dir, const program& prog, F& add) {
+  timer t(timer::keys);
+  for (TKey& key : get_keys(dir)) scan_key(key,prog,add);
+}
+
+// Keys with the same names and cycles in separately opened copies
+// of their files. Forked processes must reopen input files, because
+// they would otherwise share file offsets with the parent process.
+class key_reopener {
+  std::vector<std::pair<const TFile*,std::unique_ptr<TFile>>> files;
+public:
+  TKey* operator()(TKey* key);
+};
+
+using scan_result = std::vector<std::pair<shared_str,hist>>;
+
+// Scan input files on njobs threads, each thread with its own TFile handles.
+// Results are returned in the order in which the serial scan finds them.
+// Opened files are appended to files and must outlive the histograms.
+std::vector<scan_result> scan_parallel(
+  const std::vector<const char*>& ifnames,
+  const program& prog, unsigned njobs,
+  std::vector<std::unique_ptr<TFile>>& files);
+
+#endif
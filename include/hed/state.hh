@@ -0,0 +1,63 @@
+#ifndef IVANP_HED_STATE_HH
+#define IVANP_HED_STATE_HH
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <type_traits>
+
+#include "hed/hist.hh"
+
+// 64-bit FNV-1a hash
+class fnv1a {
+  uint64_t h = 0xcbf29ce484222325;
+public:
+  fnv1a& add(const void* p, size_t n) noexcept {
+    for (auto* c = static_cast<const unsigned char*>(p); n; --n, ++c)
+      h = (h ^ *c) * 0x100000001b3;
+    return *this;
+  }
+  template <typename T>
+  std::enable_if_t<std::is_arithmetic<T>::value,fnv1a&>
+  operator()(T x) noexcept { return add(&x,sizeof(x)); }
+  // strings are hashed with the terminator to keep fields apart
+  fnv1a& operator()(const char* s) noexcept {
+    return s ? add(s,strlen(s)+1) : add("",1);
+  }
+  fnv1a& operator()(const std::string& s) noexcept {
+    return add(s.c_str(),s.size()+1);
+  }
+  inline uint64_t value() const noexcept { return h; }
+};
+
+// Add histogram contents and drawing attributes to the hash
+void hash_hist(fnv1a& hash, const hist& h);
+
+// Pages rendered in previous runs, kept in OUTPUT.hed/ next to the output,
+// with a state file listing the hash and title of every page
+class page_cache {
+public:
+  struct entry {
+    bool drawn; // false if the group was skipped by canvas expressions
+    std::string title;
+  };
+private:
+  std::string _dir;
+  std::unordered_map<uint64_t,entry> _old, _new;
+public:
+  page_cache(const std::string& ofname); // reads state file if it exists
+  page_cache(const page_cache&) = delete;
+
+  std::string file(uint64_t hash) const; // name of the page file
+
+  // Previous result for the hash, or nullptr if the page needs to be drawn
+  const entry* find(uint64_t hash) const;
+
+  void set(uint64_t hash, entry e) { _new[hash] = std::move(e); }
+
+  // Write the state file and remove pages that were not set in this run
+  void save() const;
+};
+
+#endif
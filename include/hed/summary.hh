@@ -0,0 +1,27 @@
+#ifndef IVANP_HED_SUMMARY_HH
+#define IVANP_HED_SUMMARY_HH
+
+class TH1;
+
+// Statistics of regular bins of a histogram, computed in one pass
+struct hist_summary {
+  double integral, integral_width; // within axes ranges, as TH1::Integral
+  double min, max;         // of non-empty bins
+  double min_err, max_err; // of content -/+ error for non-empty bins
+  double min_pos;          // smallest positive content, for log scale
+  bool nonzero;            // any bin with non-zero content
+
+  hist_summary(const TH1* h);
+};
+
+// Summaries are cached per histogram.
+// A summary has to be forgotten when the histogram's bins change,
+// or when it is deleted.
+hist_summary summary(const TH1* h);
+void forget_summary(const TH1* h);
+
+// TProfile, TProfile2D or TProfile3D, whose bin arrays hold sums of y*w
+// rather than bin contents
+bool is_profile(const TH1* h);
+
+#endif
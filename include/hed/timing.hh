@@ -0,0 +1,54 @@
+#ifndef IVANP_HED_TIMING_HH
+#define IVANP_HED_TIMING_HH
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+// Time spent in phases of the program, summed over threads.
+// Nested timers are exclusive: time of the inner phase is not
+// counted towards the outer one.
+class timer {
+public:
+  enum phase {
+    open, keys, read, exprs, group, range, draw, print, nphases
+  };
+  static bool enabled;
+
+private:
+  using clock = std::chrono::steady_clock;
+  static std::array<std::atomic<long long>,nphases> total; // ns
+  static thread_local timer* current;
+
+  timer* parent;
+  clock::time_point start;
+  phase p;
+  bool on;
+
+  inline void add(clock::time_point now) noexcept {
+    total[p] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      now - start).count();
+  }
+
+public:
+  timer(phase p) noexcept: p(p), on(enabled) {
+    if (!on) return;
+    start = clock::now();
+    parent = current;
+    if (parent) parent->add(start);
+    current = this;
+  }
+  ~timer() {
+    if (!on) return;
+    const auto now = clock::now();
+    add(now);
+    current = parent;
+    if (parent) parent->start = now;
+  }
+  timer(const timer&) = delete;
+
+  static void report(std::ostream&);
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef IVANP_HED_WATCH_HH
+#define IVANP_HED_WATCH_HH
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include <TFile.h>
+
+#include "shared_str.hh"
+#include "hed/expr.hh"
+#include "hed/hist.hh"
+
+// Input files watched with inotify.
+// Histograms are kept as they are after the -e expressions,
+// and only keys that are new or have changed are read again.
+class watcher {
+  struct entry {
+    std::string id; // path;cycle
+    // a key is unchanged only if all of these are the same,
+    // because rewritten files and overwrites may reuse offsets
+    Long64_t seek;
+    UInt_t datime;
+    Int_t nbytes, objlen;
+    shared_str group; // null if not selected
+    hist h;
+  };
+  struct file {
+    const char* name;
+    std::unique_ptr<TFile> f;
+    std::vector<entry> keys; // in the order of the scan
+    int wd; // inotify watch descriptor of the directory
+    std::string base; // name within the directory
+    bool changed;
+  };
+  std::vector<file> files;
+  int fd;
+
+  void rescan(file& f, const program& prog);
+
+public:
+  watcher(const std::vector<const char*>& names);
+  ~watcher();
+  watcher(const watcher&) = delete;
+
+  // Read changed files again
+  void scan(const program& prog);
+
+  // Pass copies of the selected histograms to add(group,h),
+  // in the order of the serial scan
+  template <typename F>
+  void add(F& add) const {
+    for (const auto& f : files)
+      for (const auto& e : f.keys)
+        if (e.group) add(shared_str(e.group),copy(e.h));
+  }
+
+  // Block until input files change and stop changing
+  void wait();
+
+  static hist copy(const hist& h);
+};
+
+#endif
@@ -5,22 +5,10 @@
 #include <limits>
 #include <cmath>
 
-template <typename Hs>
-std::pair<double,double> hists_range_y(Hs& hs, bool logy) {
-  double ymin = std::numeric_limits<double>::max(),
-         ymax = (logy ? 0 : std::numeric_limits<double>::min());
-
-  for (auto& h : hs) {
-    for (int i=1, n=h->GetNbinsX(); i<=n; ++i) {
-      double y = h->GetBinContent(i);
-      if (logy && y<=0.) continue;
-      double e = h->GetBinError(i);
-      if (y==0. && e==0.) continue; // ignore empty bins
-      if (y<ymin) ymin = y;
-      if (y>ymax) ymax = y;
-    }
-  }
-
+// Add margins to the range of values, as for the y axis of a plot
+inline std::pair<double,double> pad_range_y(
+  double ymin, double ymax, bool logy
+) {
   if (logy) {
     std::tie(ymin,ymax) = std::forward_as_tuple(
       std::pow(10.,1.05*std::log10(ymin) - 0.05*std::log10(ymax)),
@@ -51,4 +39,23 @@ std::pair<double,double> hists_range_y(Hs& hs, bool logy) {
   return { ymin, ymax };
 }
 
+template <typename Hs>
+std::pair<double,double> hists_range_y(Hs& hs, bool logy) {
+  double ymin = std::numeric_limits<double>::max(),
+         ymax = (logy ? 0 : std::numeric_limits<double>::min());
+
+  for (auto& h : hs) {
+    for (int i=1, n=h->GetNbinsX(); i<=n; ++i) {
+      double y = h->GetBinContent(i);
+      if (logy && y<=0.) continue;
+      double e = h->GetBinError(i);
+      if (y==0. && e==0.) continue; // ignore empty bins
+      if (y<ymin) ymin = y;
+      if (y>ymax) ymax = y;
+    }
+  }
+
+  return pad_range_y(ymin,ymax,logy);
+}
+
 #endif
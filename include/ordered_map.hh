@@ -124,6 +124,10 @@ public:
     map.erase(*u);
     return order.erase(u);
   }
+  void clear() noexcept {
+    order.clear();
+    map.clear();
+  }
 };
 
 #endif
@@ -2,6 +2,8 @@
 #define IVANP_SHARED_STR_HH
 
 #include <memory>
+#include <string>
+#include <vector>
 
 using shared_str = std::shared_ptr<std::string>;
 
@@ -11,4 +13,33 @@ inline auto make_shared_str(Args&&... args) {
     std::forward<Args>(args)... );
 }
 
+// Strings reused between histograms to avoid allocations.
+// After reset(), a string is handed out again only if nothing
+// outside the pool refers to it anymore.
+// Strings that need to outlive reset() should be copied.
+class shared_str_pool {
+  std::vector<shared_str> strs;
+  size_t next = 0;
+
+public:
+  shared_str get() {
+    while (next < strs.size()) {
+      const shared_str& str = strs[next++];
+      if (str.use_count()==1) {
+        str->clear();
+        return str;
+      }
+    }
+    strs.emplace_back(make_shared_str());
+    ++next;
+    return strs.back();
+  }
+  inline void reset() noexcept { next = 0; }
+
+  static shared_str_pool& local() {
+    static thread_local shared_str_pool pool;
+    return pool;
+  }
+};
+
 #endif
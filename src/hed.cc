@@ -7,10 +7,14 @@
 #include <stdexcept>
 #include <memory>
 #include <chrono>
+#include <thread>
+#include <map>
+#include <unordered_set>
 
 #include <TFile.h>
 #include <TDirectory.h>
 #include <TLine.h>
+#include <Compression.h>
 
 #include "program_options.hh"
 #include "tkey.hh"
@@ -20,6 +24,13 @@
 #include "hed/hist.hh"
 #include "hed/canv.hh"
 #include "hed/verbosity.hh"
+#include "hed/scan.hh"
+#include "hed/pages.hh"
+#include "hed/state.hh"
+#include "hed/timing.hh"
+#include "hed/summary.hh"
+#include "hed/daemon.hh"
+#include "hed/watch.hh"
 #include "transform_iterator.hh"
 #include "hist_range.hh"
 #include "ring.hh"
@@ -44,44 +55,44 @@ InputIt rfind(InputIt first, InputIt last, Pred&& pred) {
 }
 
 std::vector<expression> hist_exprs, canv_exprs;
+program hist_prog, canv_prog; // compiled expressions
 ordered_map<
   std::vector<hist>, shared_str,
   deref_pred<std::hash<std::string>>,
   deref_pred<std::equal_to<std::string>>
 > group_map;
 
-void loop(TDirectory* dir) { // LOOP
-  for (TKey& key : get_keys(dir)) {
-    const TClass* key_class = get_class(key);
+auto add_to_group = [](shared_str&& group, hist&& h) {
+  group_map[std::move(group)].emplace_back(std::move(h));
+};
 
-    if (key_class->InheritsFrom(TH1::Class())) { // HIST
-
-      hist h(read_key<TH1>(key));
-      shared_str group;
-
-      if ( !h(hist_exprs,group) ) continue;
-      // add hist if it passes selection
-      group_map[std::move(group)].emplace_back(std::move(h));
-
-    } else if (key_class->InheritsFrom(TDirectory::Class())) { // DIR
-      loop(read_key<TDirectory>(key));
-    }
-  }
-}
+inline hist_summary get_summary(const hist& h) { return summary(h.h); }
+// ratio histograms are drawn once, their summaries aren't cached
+inline hist_summary get_summary(const TH1* h) { return { h }; }
 
 template <typename Hs>
 void auto_range(Hs& hs) {
+  timer t(timer::range);
   auto& _h = hs.front();
   const bool ymin_set = (_h->GetMinimumStored()!=-1111),
              ymax_set = (_h->GetMaximumStored()!=-1111);
   if (!ymin_set || !ymax_set) {
-    const auto range_y = hists_range_y(hs,gPad->GetLogy());
+    const bool logy = gPad->GetLogy();
+    double ymin = std::numeric_limits<double>::max(),
+           ymax = (logy ? 0 : std::numeric_limits<double>::min());
+    for (const auto& h : hs) {
+      const auto s = get_summary(h);
+      ymin = std::min(ymin, logy ? s.min_pos : s.min);
+      ymax = std::max(ymax, s.max);
+    }
+    const auto range_y = pad_range_y(ymin,ymax,logy);
     if (!ymin_set) _h->SetMinimum(range_y.first);
     if (!ymax_set) _h->SetMaximum(range_y.second);
   }
 }
 
 verbosity verbose;
+ring<std::vector<Color_t>> colors;
 
 void print_primitives(TPad* pad, unsigned i=0) {
   for (auto* p : *pad->GetListOfPrimitives()) {
@@ -95,20 +106,176 @@ void print_primitives(TPad* pad, unsigned i=0) {
   }
 }
 
+// Draw group of histograms on canvas::c
+// Returns false if the group is rejected by canvas expressions
+bool draw_group(canvas& canv, shared_str& group) {
+  timer t(timer::draw);
+  { timer t(timer::exprs);
+    if (!canv(canv_prog,group)) return false;
+  }
+  TCanvas& _c = *canv;
+  if (canv.rat) getpad(&_c,1)->cd();
+
+  auto& hs = *canv.hh;
+  TH1* _h = hs.front().h;
+  _h->SetStats(false);
+
+  auto_range(hs);
+
+  unsigned i = 0;
+  for (auto& h : hs) {
+    // TODO: make these overridable
+    if (colors) {
+      const auto color = colors[i];
+      h->SetLineColor(color);
+      h->SetMarkerColor(color);
+    }
+    h->SetLineWidth(2);
+    h->Draw(cat(h->GetOption(),h.h==_h ? "" : "SAME").c_str());
+    ++i;
+  }
+
+  canv.draw();
+
+  if (canv.rat) { // draw ratio plots
+    TVirtualPad* pad = getpad(&_c,2);
+    pad->cd();
+    pad->SetTickx();
+
+    std::vector<TH1*> hh;
+    const unsigned n = hs.size();
+    hh.reserve(n);
+
+    TAxis *_ax = _h->GetXaxis();
+    TAxis *_ay = _h->GetYaxis();
+
+    for (unsigned i=0; i<n; ++i) {
+      TH1* h = static_cast<TH1*>(hs[i]->Clone());
+      h->SetTitle("");
+      h->SetYTitle("ratio");
+      h->SetMinimum(-1111);
+      h->SetMaximum(-1111);
+      h->GetListOfFunctions()->Clear();
+      h->SetStats(false);
+      divide(h,i?_h:h,canvas::rat_width);
+      if (!i) {
+        TAxis * ax =  h->GetXaxis();
+        TAxis * ay =  h->GetYaxis();
+
+        // TODO: compute correct scaling factors
+        _ay->SetTitleSize(_ay->GetTitleSize()*1.6);
+        ax->SetTitleSize(_ax->GetTitleSize()*3.5);
+        ay->SetTitleSize(ay->GetTitleSize()*2.5);
+        ay->SetTitleOffset(ay->GetTitleOffset()*0.66);
+
+        const auto tx = _ax->GetTickLength();
+        _ax->SetTickLength(tx*1.1);
+        ax->SetTickLength(tx*3.3);
+        const auto ty = _ay->GetTickLength()*0.66;
+        _ay->SetTickLength(ty);
+        ay->SetTickLength(ty);
+        const auto lx = _ax->GetLabelSize();
+        ax->SetLabelSize(lx*3.5);
+        const auto ly = _ay->GetLabelSize();
+        _ay->SetLabelSize(ly*1.5);
+        ay->SetLabelSize(ly*2.5);
+
+        h->Draw();
+      } else {
+        h->Draw("SAME");
+      }
+      hh.push_back(h);
+      canv.objs.push_back(h);
+    }
+    auto_range(hh); // Y-axis range
+  }
+
+  return true;
+}
+
+// Append the command line to the pdf file
+void write_cmd(const std::string& ofname, int argc, char* argv[]) {
+  std::ofstream pdf(ofname, std::ofstream::out | std::ofstream::app);
+  pdf << '\n';
+  bool quote = false, ge = false;
+  for (int i=0; i<argc; ++i) {
+    if (argv[i][0]=='-') {
+      pdf << '\n';
+      if (argv[i][1]=='e' || argv[i][1]=='g') ge = true;
+      else quote = false;
+    }
+    if (quote) pdf << '\'';
+    pdf << argv[i];
+    if (quote) pdf << '\'';
+    pdf << ' ';
+    if (ge) ge = false, quote = true;
+  }
+}
+
+// ROOT compression settings from algorithm name and level
+int compression_settings(const std::pair<std::string,int>& opt) {
+  using alg = ROOT::RCompressionSetting::EAlgorithm;
+  static const std::map<std::string,std::pair<alg::EValues,int>> algs {
+    {"zlib",{alg::kZLIB,1}}, {"lzma",{alg::kLZMA,7}},
+    {"lz4" ,{alg::kLZ4 ,4}}, {"zstd",{alg::kZSTD,5}}
+  };
+  const auto it = algs.find(opt.first);
+  if (it==algs.end()) throw ivanp::error(
+    "unknown compression algorithm \"",opt.first,'\"');
+  return ROOT::CompressionSettings(it->second.first,
+    opt.second < 0 ? it->second.second : opt.second);
+}
+
+// Make directory for group in ROOT file and write canvas c there, if given.
+// Canvas is named by the last part of the group path.
+TDirectory* write_group(TDirectory* fout, const std::string& group, TObject* c) {
+  timer t(timer::print);
+  const auto slash = c ? group.rfind('/') : std::string::npos;
+  TDirectory* dir = !c ? fout->mkdir(group.c_str(),"",true)
+    : slash==std::string::npos ? fout
+    : fout->mkdir(group.substr(0,slash).c_str(),"",true);
+  if (!dir) throw ivanp::error("cannot make directory for ",group);
+  if (c) dir->WriteTObject(c,
+    slash==std::string::npos ? group.c_str() : group.c_str()+slash+1);
+  return dir;
+}
+
+// Write histograms of a group with distinct keys instead of cycles
+// of the same name: legend if set, otherwise histogram name,
+// with _2, _3, ... appended to repeated names
+void write_hists(TDirectory* dir, const std::vector<hist>& hs) {
+  timer t(timer::print);
+  std::unordered_set<std::string> names;
+  for (const auto& h : hs) {
+    std::string name = h.legend && !h.legend->empty()
+      ? *h.legend : std::string(h->GetName());
+    for (char& c : name) if (c=='/' || c==';') c = '_';
+    if (!names.insert(name).second) {
+      for (unsigned i=2; ; ++i) {
+        std::string name2 = name + '_' + std::to_string(i);
+        if (names.insert(name2).second) { name = std::move(name2); break; }
+      }
+    }
+    dir->WriteTObject(h.h,name.c_str());
+  }
+}
+
 #define RC(N,R,G,B) "\033[1;38;2;" #R ";" #G ";" #B "m" #N
 
-int main(int argc, char* argv[]) {
-  std::string ofname;
+int run(int argc, char* argv[], std::string& ofname) {
   std::vector<const char*> ifnames;
   std::vector<const char*> hist_exprs_args, canv_exprs_args;
   bool sort_groups = false, remove_blank = false;
-  ring<std::vector<Color_t>> colors;
   enum class Ext { pdf, root } ext = Ext::pdf;
   int collation = 1;
+  std::pair<std::string,int> compress {{},-1};
+  bool no_paint = false, incremental = false, bounded = false, watch = false;
+  unsigned njobs = 1, ndraw = 1;
+  unsigned ncores = std::thread::hardware_concurrency();
+  const auto start = std::chrono::steady_clock::now();
 
   try {
     using namespace ivanp::po;
-    const auto start = std::chrono::steady_clock::now();
     if (program_options()
       (ifnames,'i',"input files (.root)",req(),pos())
       (ofname,'o',"output file (.pdf|.root)")
@@ -117,7 +284,26 @@ int main(int argc, char* argv[]) {
       (sort_groups,"--sort","sort groups alphabetically")
       (collation,"--collate","collate pdf pages")
       (remove_blank,{"-b","--remove-blank"},"skip blank canvases")
+      (bounded,"--bounded",
+       "bounded memory: find groups first,\n"
+       "then read histograms one group at a time")
+      (njobs,'j',"scan input files on N threads",
+       switch_init(0u))
+      (ndraw,'J',"draw pdf pages in N processes (requires gs)",
+       switch_init(0u))
+      (incremental,"--incremental",
+       "redraw only changed pages, keeping them in OUTPUT.hed/\n"
+       "(requires gs)")
+      (watch,"--watch",
+       "keep running and redraw pages when input files change\n"
+       "(implies --incremental)")
       (*colors,"--colors","color palette")
+      (compress,"--compress","ROOT output compression: alg[:level]\n"
+       "alg = zlib, lzma, lz4, zstd")
+      (no_paint,"--no-paint",
+       "ROOT output: write groups as directories of histograms\n"
+       "instead of drawing canvases")
+      (timer::enabled,"--timing","print time spent in each phase")
       (verbose,{"-v","--verbose"}, "print debug info\n"
        "e : expressions\n"
        "m : matched\n"
@@ -127,6 +313,7 @@ int main(int argc, char* argv[]) {
        switch_init(verbosity::all))
       .help_suffix(
         "expression format: suffix/regex/subst/expr\n"
+        "daemon: hed --daemon SOCKET, requests are sent with hedc\n"
         "good palettes:\n"
         // https://root.cern.ch/doc/master/classTColor.html
         "\t"
@@ -152,6 +339,17 @@ int main(int argc, char* argv[]) {
         "https://github.com/ivankp/root_tools2"
       ).parse(argc,argv,true)) return 0;
 
+    // -j, -J without a number: one per core
+    if (!njobs || !ndraw) {
+      if (!ncores) {
+        cerr << "\033[33mcould not determine number of cores,"
+                " using 1 thread/process\033[0m" << endl;
+        ncores = 1;
+      }
+      if (!njobs) njobs = ncores;
+      if (!ndraw) ndraw = ncores;
+    }
+
     // default ofname derived from ifname
     if (ofname.empty() && ifnames.size()==1) {
       const char* name = ifnames.front();
@@ -169,6 +367,12 @@ int main(int argc, char* argv[]) {
     } else if (!ends_with(ofname,".pdf")) throw std::runtime_error(
       "output file name must end in \".pdf\" or \".root\"");
 
+    if (watch) {
+      if (ext!=Ext::pdf || bounded) throw std::runtime_error(
+        "--watch requires pdf output and cannot be used with --bounded");
+      incremental = true;
+    }
+
     if (!hist_exprs_args.empty()) {
       expression::parse_canv = false;
       hist_exprs.reserve(hist_exprs_args.size());
@@ -177,6 +381,10 @@ int main(int argc, char* argv[]) {
       for (const char* str : hist_exprs_args) {
         while (*str) hist_exprs.emplace_back(str);
       }
+      merge_selections(hist_exprs);
+      hist_prog = program(hist_exprs);
+      if (verbose(verbosity::exprs))
+        cout << "\033[35mHist program:\033[0m\n" << hist_prog;
     }
 
     if (!canv_exprs_args.empty()) {
@@ -187,6 +395,9 @@ int main(int argc, char* argv[]) {
       for (const char* str : canv_exprs_args) {
         while (*str) canv_exprs.emplace_back(str);
       }
+      canv_prog = program(canv_exprs);
+      if (verbose(verbosity::exprs))
+        cout << "\033[35mCanv program:\033[0m\n" << canv_prog;
     }
 
     if (verbose) {
@@ -202,158 +413,335 @@ int main(int argc, char* argv[]) {
   }
 
   // Group histograms ***********************************************
-  std::vector<std::unique_ptr<TFile>> ifiles;
-  ifiles.reserve(ifnames.size());
-  for (const char* name : ifnames) {
-    ifiles.emplace_back(std::make_unique<TFile>(name));
-    TFile* f = ifiles.back().get();
-    if (f->IsZombie()) return 1;
-    cout << "\033[34mInput file:\033[0m " << f->GetName() << endl;
-
-    loop(f);
+  if (bounded) {
+    applicator<hist>::planning = true;
+    applicator<hist>::plan_fcns = has_predicates(hist_exprs);
   }
-  if (remove_blank) {
-    for (auto it=group_map.begin(); it!=group_map.end(); ) {
-      for (const auto& h : it->second) {
-        for (int i=1, n=h->GetNbinsX(); i<=n; ++i)
-          if (h->GetBinContent(i) != 0) {
-            ++it;
-            goto loop_end;
-          }
+  std::vector<std::unique_ptr<TFile>> ifiles;
+  std::unique_ptr<watcher> watched;
+  if (watch) {
+    try {
+      watched = std::make_unique<watcher>(ifnames);
+      watched->scan(hist_prog);
+    } catch (const std::exception& e) {
+      cerr <<"\033[31m"<< e.what() <<"\033[0m"<< endl;
+      return 1;
+    }
+    watched->add(add_to_group);
+  } else if (njobs > 1) {
+    try {
+      for (auto& result : scan_parallel(ifnames,hist_prog,njobs,ifiles))
+        for (auto& gh : result)
+          add_to_group(std::move(gh.first),std::move(gh.second));
+    } catch (const std::exception& e) {
+      cerr <<"\033[31m"<< e.what() <<"\033[0m"<< endl;
+      return 1;
+    }
+  } else {
+    ifiles.reserve(ifnames.size());
+    for (const char* name : ifnames) {
+      TFile* f = cached_input(name);
+      if (!f) {
+        { timer t(timer::open);
+          ifiles.emplace_back(std::make_unique<TFile>(name));
+        }
+        f = ifiles.back().get();
+        if (f->IsZombie()) return 1;
+        note_input(name);
       }
-      it = group_map.erase(it);
-      loop_end: ;
+      cout << "\033[34mInput file:\033[0m " << f->GetName() << endl;
+
+      scan(f,hist_prog,add_to_group);
     }
   }
-  if (sort_groups) group_map.sort(
-    [](const auto& a, const auto& b){ return *(a->first) < *(b->first); });
-
-  if (ext==Ext::pdf) {
-    // Draw histograms ************************************************
-    TCanvas _c;
-    canvas::c = &_c;
-
-    cout << "\033[34mOutput file:\033[0m " << ofname << endl;
-    unsigned group_back_cnt = group_map.size();
-    if (group_back_cnt > 1) ofname += '(';
-    bool first_group = true;
-    for (auto& g : collator(group_map,collation)) {
-      --group_back_cnt;
-      shared_str group = g.first; // need to copy pointer here
-                                  // because canvas can make new string
-      cout <<"\033[36m"<< *group << "\033[0m\n";
-
-      canvas canv(&g.second);
-      if (!canv(canv_exprs,group)) continue;
-      if (canv.rat) getpad(&_c,1)->cd();
-
-      TH1* _h = g.second.front().h;
-      _h->SetStats(false);
-
-      auto_range(g.second);
-
-      unsigned i = 0;
-      for (auto& h : g.second) {
-        // TODO: make these overridable
-        if (colors) {
-          const auto color = colors[i];
-          h->SetLineColor(color);
-          h->SetMarkerColor(color);
+  if (verbose(verbosity::exprs)) {
+    cout << "\033[35mExpression cache:\033[0m\n";
+    print_cache_stats(cout,hist_exprs);
+  }
+  applicator<hist>::planning = false;
+
+  // Plugins with a run_batch entry point get all histograms at once.
+  // In bounded memory mode, this is done for each group when it's loaded.
+  if (bounded) drop_batches();
+  else {
+    std::vector<TH1*> hs;
+    for (const auto& g : group_map)
+      for (const auto& h : g.second) hs.push_back(h.h);
+    timer t(timer::exprs);
+    run_batches(hs);
+  }
+
+  // In bounded memory mode, histograms are read and expressions are
+  // applied again when groups are drawn.
+  // Returns false if the group is blank and needs to be skipped.
+  auto load_group = [&](std::vector<hist>& hs, key_reopener* reopen) {
+    if (!bounded) return true;
+    { struct quiet { // already printed when groups were found
+        quiet() { expression::quiet = true; }
+        ~quiet() { expression::quiet = false; }
+      } q;
+      for (auto& h : hs) {
+        shared_str group;
+        hist fresh(reopen ? (*reopen)(h.key) : h.key);
+        fresh(hist_prog,group);
+        h = std::move(fresh);
+      }
+    }
+    { std::vector<TH1*> hh;
+      hh.reserve(hs.size());
+      for (const auto& h : hs) hh.push_back(h.h);
+      run_batches(hh);
+    }
+    if (remove_blank && std::none_of(hs.begin(),hs.end(),
+          [](const hist& h){ return summary(h.h).nonzero; })) {
+      for (auto& h : hs) h.release();
+      return false;
+    }
+    return true;
+  };
+  auto free_group = [&](std::vector<hist>& hs) {
+    if (bounded) for (auto& h : hs) h.release();
+  };
+
+  // Group and draw or write histograms, again for every change with --watch
+  auto output = [&]() -> int {
+    { timer t(timer::group);
+      if (remove_blank && !bounded) {
+        for (auto it=group_map.begin(); it!=group_map.end(); ) {
+          if (std::any_of(it->second.begin(),it->second.end(),
+                [](const hist& h){ return summary(h.h).nonzero; })) ++it;
+          else {
+            if (watch) // copies of kept histograms
+              for (auto& h : it->second) delete_hist(h.h);
+            it = group_map.erase(it);
+          }
         }
-        h->SetLineWidth(2);
-        h->Draw(cat(h->GetOption(),h.h==_h ? "" : "SAME").c_str());
-        ++i;
       }
+      if (sort_groups) group_map.sort(
+        [](const auto& a, const auto& b){ return *(a->first) < *(b->first); });
+    }
 
-      canv.draw();
-
-      if (canv.rat) { // draw ratio plots
-        TVirtualPad* pad = getpad(&_c,2);
-        pad->cd();
-        pad->SetTickx();
-
-        std::vector<TH1*> hh;
-        const unsigned n = g.second.size();
-        hh.reserve(n);
-
-        TAxis *_ax = _h->GetXaxis();
-        TAxis *_ay = _h->GetYaxis();
-
-        for (unsigned i=0; i<n; ++i) {
-          TH1* h = static_cast<TH1*>(g.second[i]->Clone());
-          h->SetTitle("");
-          h->SetYTitle("ratio");
-          h->SetMinimum(-1111);
-          h->SetMaximum(-1111);
-          h->GetListOfFunctions()->Clear();
-          h->SetStats(false);
-          divide(h,i?_h:h,canvas::rat_width);
-          if (!i) {
-            TAxis * ax =  h->GetXaxis();
-            TAxis * ay =  h->GetYaxis();
-
-            // TODO: compute correct scaling factors
-            _ay->SetTitleSize(_ay->GetTitleSize()*1.6);
-            ax->SetTitleSize(_ax->GetTitleSize()*3.5);
-            ay->SetTitleSize(ay->GetTitleSize()*2.5);
-            ay->SetTitleOffset(ay->GetTitleOffset()*0.66);
-
-            const auto tx = _ax->GetTickLength();
-            _ax->SetTickLength(tx*1.1);
-            ax->SetTickLength(tx*3.3);
-            const auto ty = _ay->GetTickLength()*0.66;
-            _ay->SetTickLength(ty);
-            ay->SetTickLength(ty);
-            const auto lx = _ax->GetLabelSize();
-            ax->SetLabelSize(lx*3.5);
-            const auto ly = _ay->GetLabelSize();
-            _ay->SetLabelSize(ly*1.5);
-            ay->SetLabelSize(ly*2.5);
-
-            h->Draw();
+    if (ext==Ext::pdf) {
+      // Draw histograms ************************************************
+      cout << "\033[34mOutput file:\033[0m " << ofname << endl;
+
+      if (ndraw > 1 || incremental) { // draw pages into separate files
+        std::vector<decltype(&group_map.front())> groups;
+        groups.reserve(group_map.size());
+        for (auto& g : collator(group_map,collation)) groups.push_back(&g);
+
+        try {
+          std::unique_ptr<page_dir> dir;
+          std::unique_ptr<page_cache> cache;
+          std::vector<uint64_t> hashes;
+          std::vector<unsigned> todo; // groups that need to be drawn
+
+          if (incremental) {
+            // hash everything that determines how pages look
+            cache = std::make_unique<page_cache>(ofname);
+            fnv1a seed;
+            for (const char* arg : hist_exprs_args) seed(arg);
+            seed('|');
+            for (const char* arg : canv_exprs_args) seed(arg);
+            seed('|');
+            if (colors) for (Color_t c : *colors) seed(c);
+
+            hashes.reserve(groups.size());
+            for (unsigned i=0; i<groups.size(); ++i) {
+              fnv1a hash = seed;
+              hash(*groups[i]->first);
+              const bool kept = load_group(groups[i]->second,nullptr);
+              hash(kept);
+              if (kept) { // blank groups are already released
+                for (const auto& h : groups[i]->second) hash_hist(hash,h);
+                free_group(groups[i]->second);
+              }
+              hashes.push_back(hash.value());
+              if (!cache->find(hashes.back())) todo.push_back(i);
+            }
+            cout << "\033[34mRedrawing:\033[0m " << todo.size()
+                 << " of " << groups.size() << " pages" << endl;
           } else {
-            h->Draw("SAME");
+            dir = std::make_unique<page_dir>(ofname);
+            todo.resize(groups.size());
+            for (unsigned i=0; i<todo.size(); ++i) todo[i] = i;
+          }
+          auto file = [&](unsigned i) {
+            return cache ? cache->file(hashes[i]) : dir->file(i);
+          };
+
+          key_reopener reopen; // each drawing process reopens input files
+          auto drawn = fork_pages(todo.size(),ndraw,
+            [&](unsigned k, std::string& title) {
+              if (!canvas::c) canvas::c = new TCanvas();
+              const unsigned i = todo[k];
+              auto& g = *groups[i];
+              shared_str group = g.first;
+              cout <<"\033[36m"<< *group << "\033[0m\n";
+
+              if (!load_group(g.second, ndraw > 1 ? &reopen : nullptr))
+                return false;
+              canvas canv(&g.second);
+              if (!draw_group(canv,group)) {
+                free_group(g.second);
+                return false;
+              }
+              { timer t(timer::print);
+                canv->Print(file(i).c_str());
+              }
+              title = *group;
+
+              if (verbose(verbosity::canv)) {
+                print_primitives(canvas::c);
+                cout.flush();
+              }
+              canv->Clear();
+              free_group(g.second);
+              return true;
+            });
+
+          std::vector<page> pages;
+          for (unsigned i=0, k=0; i<groups.size(); ++i) {
+            page_cache::entry e;
+            if (k<todo.size() && todo[k]==i) {
+              e = { drawn[k].first, std::move(drawn[k].second) };
+              ++k;
+            } else if (const auto* old = cache->find(hashes[i])) e = *old;
+            else throw ivanp::error(
+              "cached page ",cache->file(hashes[i])," disappeared");
+            if (e.drawn) pages.push_back({ file(i), e.title });
+            if (cache) cache->set(hashes[i],std::move(e));
+          }
+          { timer t(timer::print);
+            assemble_pdf(ofname,pages);
           }
-          hh.push_back(h);
-          canv.objs.push_back(h);
+          if (cache) cache->save();
+        } catch (const std::exception& e) {
+          cerr <<"\033[31m"<< e.what() <<"\033[0m"<< endl;
+          return 1;
         }
-        auto_range(hh); // Y-axis range
-      }
 
-      if (!group_back_cnt) {
-        if (first_group) first_group = false;
-        else ofname += ')';
-      }
-      canv->Print(ofname.c_str(),("Title:"+*group).c_str());
-      if (first_group) ofname.pop_back(), first_group = false;
+      } else {
+        TCanvas _c;
+        canvas::c = &_c;
+
+        unsigned group_back_cnt = group_map.size();
+        if (group_back_cnt > 1) ofname += '(';
+        bool first_group = true;
+        for (auto& g : collator(group_map,collation)) {
+          --group_back_cnt;
+          shared_str group = g.first; // need to copy pointer here
+                                      // because canvas can make new string
+          cout <<"\033[36m"<< *group << "\033[0m\n";
+
+          if (!load_group(g.second,nullptr)) continue;
+          canvas canv(&g.second);
+          if (!draw_group(canv,group)) {
+            free_group(g.second);
+            continue;
+          }
+
+          if (!group_back_cnt) {
+            if (first_group) first_group = false;
+            else ofname += ')';
+          }
+          { timer t(timer::print);
+            canv->Print(ofname.c_str(),("Title:"+*group).c_str());
+          }
+          if (first_group) ofname.pop_back(), first_group = false;
+
+          if (verbose(verbosity::canv)) {
+            print_primitives(&_c);
+            cout.flush();
+          }
+
+          _c.Clear();
+          free_group(g.second);
+        }
 
-      if (verbose(verbosity::canv)) {
-        print_primitives(&_c);
-        cout.flush();
+        if (ofname.back()==')') ofname.pop_back();
       }
 
-      _c.Clear();
-    }
+      write_cmd(ofname,argc,argv);
+
+    } else if (ext==Ext::root) {
+      // Write histograms ***********************************************
+      std::unique_ptr<TFile> fout;
+      try {
+        fout = compress.first.empty()
+          ? std::make_unique<TFile>(ofname.c_str(),"recreate")
+          : std::make_unique<TFile>(ofname.c_str(),"recreate","",
+              compression_settings(compress));
+      } catch (const std::exception& e) {
+        cerr <<"\033[31m"<< e.what() <<"\033[0m"<< endl;
+        return 1;
+      }
+      if (fout->IsZombie()) return 1;
+      cout << "\033[34mOutput file:\033[0m " << ofname << endl;
+
+      TCanvas _c;
+      canvas::c = &_c;
+
+      for (auto& g : collator(group_map,collation)) {
+        shared_str group = g.first;
+        cout <<"\033[36m"<< *group << "\033[0m\n";
+
+        if (!load_group(g.second,nullptr)) continue;
+        { canvas canv(&g.second);
+          if (no_paint) {
+            if (canv(canv_prog,group)) {
+              write_hists(write_group(fout.get(),*group,nullptr),g.second);
+            }
+          } else if (draw_group(canv,group)) {
+            write_group(fout.get(),*group,&_c);
+          }
+        }
 
-    if (ofname.back()==')') ofname.pop_back();
-    std::ofstream pdf(ofname, std::ofstream::out | std::ofstream::app);
-    pdf << '\n';
-    bool quote = false, ge = false;
-    for (int i=0; i<argc; ++i) {
-      if (argv[i][0]=='-') {
-        pdf << '\n';
-        if (argv[i][1]=='e' || argv[i][1]=='g') ge = true;
-        else quote = false;
+        // write each group as soon as it's done and free memory
+        _c.Clear();
+        for (auto& h : g.second) delete_hist(h.h);
+        g.second.clear();
       }
-      if (quote) pdf << '\'';
-      pdf << argv[i];
-      if (quote) pdf << '\'';
-      pdf << ' ';
-      if (ge) ge = false, quote = true;
     }
+    return 0;
+  };
+  if (const int status = output()) return status;
+
+  if (timer::enabled) {
+    cout << "\033[35mTiming:\033[0m\n";
+    timer::report(cout);
+    if (ext==Ext::pdf && ndraw > 1)
+      cout << "drawing and printing in child processes not counted\n";
+    cout << "wall time "
+         << std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - start
+            ).count()
+         << " ms" << endl;
+  }
 
-  } else if (ext==Ext::root) {
-    // TODO: root output
-    throw std::runtime_error("ROOT output not implemented yet");
+  while (watch) {
+    for (auto& g : group_map)
+      for (auto& h : g.second) delete_hist(h.h);
+    group_map.clear();
+    try {
+      watched->wait();
+      watched->scan(hist_prog);
+    } catch (const std::exception& e) {
+      cerr <<"\033[31m"<< e.what() <<"\033[0m"<< endl;
+      return 1;
+    }
+    watched->add(add_to_group);
+    // keep watching, the next change may fix it
+    if (const int status = output())
+      cerr << "\033[31moutput failed with status " << status
+           << ", waiting for the next change\033[0m" << endl;
   }
+
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc==3 && !strcmp(argv[1],"--daemon")) return serve(argv[2],run);
+  std::string ofname;
+  return run(argc,argv,ofname);
 }
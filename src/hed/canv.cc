@@ -10,22 +10,10 @@
   std::cout << "\033[36m" #var "\033[0m = " << var << std::endl;
 
 applicator<canvas>::applicator(canvas& c, hist& h, shared_str& group)
-: applicator<hist>(h,group), c(c) { }
+: applicator<hist>(h,group) { canv = &c; }
 
-bool applicator<canvas>::hook(const expression& expr, int level) {
-  switch (expr.tag) {
-    case expression::exprs_tag: return operator()(expr.exprs,level);
-    case expression::hist_fcn_tag: expr.hist_fcn(h.h); break;
-    case expression::canv_fcn_tag: expr.canv_fcn(c); break;
-    default: ;
-  }
-  return true;
-}
-
-bool canvas::operator()(
-  const std::vector<expression>& exprs, shared_str& group
-) {
-  return applicator<canvas>(*this,hh->front(),group)(exprs);
+bool canvas::operator()(const program& prog, shared_str& group) {
+  return applicator<canvas>(*this,hh->front(),group)(prog);
 }
 
 TCanvas* canvas::c = nullptr;
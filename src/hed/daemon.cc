@@ -0,0 +1,235 @@
+#include "hed/daemon.hh"
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <climits>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <TROOT.h>
+#include <TError.h>
+#include <TFile.h>
+#include <TDirectory.h>
+#include <TClass.h>
+#include <TCanvas.h>
+#include <TH1.h>
+
+#include "tkey.hh"
+#include "error.hh"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace {
+
+struct cached_file {
+  std::unique_ptr<TFile> f;
+  struct timespec mtime;
+  off_t size;
+};
+std::map<std::string,cached_file> cache; // by absolute path
+
+int note_fd = -1; // pipe to the daemon in a request process
+
+std::string abs_path(const char* name) {
+  if (name[0]=='/') return name;
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd,sizeof(cwd))) throw ivanp::error("getcwd() failed");
+  return std::string(cwd) + '/' + name;
+}
+
+bool same_file(const cached_file& f, const struct stat& st) noexcept {
+  return f.size == st.st_size
+      && f.mtime.tv_sec  == st.st_mtim.tv_sec
+      && f.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+// read all directories, so that their key lists are in memory
+void read_dirs(TDirectory* dir) {
+  for (TKey& key : get_keys(dir))
+    if (get_class(key)->InheritsFrom(TDirectory::Class()))
+      read_dirs(read_key<TDirectory>(key));
+}
+
+void open_cached(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(),&st)) { cache.erase(path); return; }
+  auto it = cache.find(path);
+  if (it!=cache.end() && same_file(it->second,st)) return;
+
+  auto f = std::make_unique<TFile>(path.c_str());
+  if (f->IsZombie()) { cache.erase(path); return; }
+  read_dirs(f.get());
+  cache[path] = { std::move(f), st.st_mtim, st.st_size };
+  cout << "\033[34mCached:\033[0m " << path << endl;
+}
+
+// initialize what hed would otherwise initialize on every run
+void warm_up() {
+  gROOT->SetBatch(true);
+  for (const char* name : {
+    "TH1F", "TH1D", "TH2F", "TH2D", "TProfile",
+    "TDirectoryFile", "TCanvas", "TLegend", "TLatex", "TLine"
+  }) TClass::GetClass(name);
+
+  const auto level = gErrorIgnoreLevel;
+  gErrorIgnoreLevel = kWarning;
+  { TCanvas c;
+    TH1D h("","",1,0,1);
+    h.Draw();
+    c.Print("/dev/null","pdf"); // load fonts
+  }
+  gErrorIgnoreLevel = level;
+}
+
+bool write_all(int fd, const char* p, size_t n) {
+  while (n) {
+    const ssize_t m = write(fd,p,n);
+    if (m < 0) return false;
+    p += m; n -= m;
+  }
+  return true;
+}
+
+volatile sig_atomic_t stop = 0;
+void on_signal(int) { stop = 1; }
+
+void handle(int sock, int conn, hed_main* run) {
+  std::string req;
+  char buf[1<<12];
+  for (ssize_t n; (n = read(conn,buf,sizeof(buf))) > 0; ) {
+    req.append(buf,n);
+    if (req.size() > (1<<20)) throw ivanp::error("request too long");
+  }
+  if (req.empty() || req.back()!='\0') throw ivanp::error("bad request");
+
+  std::vector<char*> argv;
+  for (size_t i=0; i<req.size(); i+=strlen(&req[i])+1)
+    argv.push_back(&req[i]);
+  const char* cwd = argv.front();
+  argv.front() = const_cast<char*>("hed");
+  const int argc = argv.size();
+  argv.push_back(nullptr);
+
+  int fd[2];
+  if (pipe(fd)) throw ivanp::error("pipe() failed");
+  cout.flush();
+  const pid_t pid = fork();
+  if (pid < 0) throw ivanp::error("fork() failed");
+
+  if (pid == 0) { // request process
+    close(sock);
+    close(fd[0]);
+    note_fd = fd[1];
+    dup2(conn,1);
+    dup2(conn,2);
+    std::signal(SIGINT,SIG_DFL);
+    std::signal(SIGTERM,SIG_DFL);
+
+    std::string ofname;
+    int status = 1;
+    try {
+      if (chdir(cwd)) throw ivanp::error("cannot change directory to ",cwd);
+      status = run(argc,argv.data(),ofname);
+    } catch (const std::exception& e) {
+      cerr <<"\033[31m"<< e.what() <<"\033[0m"<< endl;
+    }
+    cout.flush();
+    cerr.flush();
+    fflush(nullptr);
+    const std::string trailer =
+      '\0' + std::to_string(status) + ' ' + ofname;
+    write_all(conn,trailer.data(),trailer.size());
+    _exit(status); // skip destructors of the daemon's objects
+  }
+
+  close(fd[1]);
+  std::string notes;
+  for (ssize_t n; (n = read(fd[0],buf,sizeof(buf))) > 0; ) notes.append(buf,n);
+  close(fd[0]);
+  int status;
+  waitpid(pid,&status,0);
+
+  for (size_t i=0; i<notes.size(); i+=strlen(&notes[i])+1)
+    open_cached(&notes[i]);
+}
+
+} // end namespace
+
+int serve(const char* socket_path, hed_main* run) {
+  sockaddr_un addr { };
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    cerr << "\033[31msocket path too long: " << socket_path
+         << "\033[0m" << endl;
+    return 1;
+  }
+  strcpy(addr.sun_path,socket_path);
+
+  warm_up();
+
+  const int sock = socket(AF_UNIX,SOCK_STREAM,0);
+  unlink(socket_path);
+  if (sock < 0 || bind(sock,(sockaddr*)&addr,sizeof(addr)) || listen(sock,16)) {
+    cerr << "\033[31mcannot listen on " << socket_path << ": "
+         << strerror(errno) << "\033[0m" << endl;
+    return 1;
+  }
+  cout << "\033[34mListening on:\033[0m " << socket_path << endl;
+
+  struct sigaction sa { };
+  sa.sa_handler = on_signal; // without SA_RESTART to interrupt accept()
+  sigaction(SIGINT,&sa,nullptr);
+  sigaction(SIGTERM,&sa,nullptr);
+
+  while (!stop) {
+    const int conn = accept(sock,nullptr,nullptr);
+    if (conn < 0) {
+      if (errno==EINTR) continue;
+      cerr << "\033[31maccept() failed: " << strerror(errno)
+           << "\033[0m" << endl;
+      break;
+    }
+    try {
+      handle(sock,conn,run);
+    } catch (const std::exception& e) {
+      cerr <<"\033[31m"<< e.what() <<"\033[0m"<< endl;
+    }
+    close(conn);
+  }
+
+  close(sock);
+  unlink(socket_path);
+  return 0;
+}
+
+TFile* cached_input(const char* name) {
+  if (note_fd < 0 || cache.empty()) return nullptr;
+  const auto it = cache.find(abs_path(name));
+  if (it==cache.end()) return nullptr;
+  struct stat st;
+  if (stat(it->first.c_str(),&st) || !same_file(it->second,st))
+    return nullptr;
+  // same name as if the request opened the file itself, for the f field;
+  // the request process is a fork, so the daemon's copy keeps its path
+  TFile* f = it->second.f.get();
+  f->SetName(name);
+  return f;
+}
+
+void note_input(const char* name) {
+  if (note_fd < 0) return;
+  const std::string path = abs_path(name);
+  write_all(note_fd,path.c_str(),path.size()+1);
+}
@@ -1,8 +1,12 @@
 #include "hed/expr.hh"
 
 #include <iostream>
+#include <iomanip>
 #include <algorithm>
 #include <iterator>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
 
 #include <boost/lexical_cast/try_lexical_convert.hpp>
 
@@ -16,6 +20,16 @@
 using namespace ivanp;
 
 bool expression::parse_canv = false;
+bool expression::threaded = false;
+bool expression::quiet = false;
+
+struct expression::cache_t {
+  // null result means the input string is returned unchanged
+  struct result_t { bool matched; shared_str result; };
+  std::unordered_map<std::string,result_t> map;
+  std::mutex mx;
+  std::atomic<unsigned long> hits {0}, misses {0};
+};
 
 const char* consume_suffix(const char* s, flags& _fl) {
   flags fl;
@@ -160,6 +174,7 @@ expression::expression(const char*& str): flags() {
       syntax_option_type flags = optimize;
       if (!subst_end) flags |= nosubs;
       re.assign(suffix_end,str,flags);
+      cache = std::make_unique<cache_t>();
     }
 
     if (subst_end) str = subst_end;
@@ -197,10 +212,16 @@ expression::expression(const char*& str): flags() {
     }
     if (!space) space = pos;
 
+    fcn.assign(str,pos);
     boost::string_view name(str,size_t(space-str)), args;
     if (space!=pos) ++space, args = { space,size_t(pos-space) };
 
-    if (parse_canv) {
+    if (function_map<TH1*,bool>::all.count(name)) {
+      new (&hist_pred) decltype(hist_pred)(
+        function_map<TH1*,bool>::make(name,args)
+      );
+      tag = hist_pred_tag;
+    } else if (parse_canv) {
       try {
         new (&canv_fcn) decltype(canv_fcn)(
           function_map<canvas&>::make(name,args)
@@ -224,10 +245,36 @@ expression::expression(const char*& str): flags() {
 } // ================================================================
 
 shared_str expression::operator()(shared_str str) const {
-  if (p) std::cout << "p: input: " << *str << std::endl;
+  if (p && !quiet) std::cout << "p: input: " << *str << std::endl;
 
   if (re.empty()) return sub ? sub : str; // no regex
 
+  // only lock when scanning on several threads
+  std::unique_lock<std::mutex> lock(cache->mx,std::defer_lock);
+  if (threaded) lock.lock();
+  const auto it = cache->map.find(*str);
+  if (it!=cache->map.end()) {
+    ++cache->hits;
+    const auto& r = it->second;
+    if (!r.matched) return { };
+    return r.result ? r.result : str;
+  }
+  ++cache->misses;
+  if (threaded) lock.unlock();
+
+  auto result = apply(str);
+
+  if (threaded) lock.lock();
+  if (cache->map.size() >= cache_max) cache->map.clear();
+  cache->map.emplace(std::piecewise_construct,
+    std::forward_as_tuple(*str),
+    std::forward_as_tuple(cache_t::result_t{ !!result,
+      // copy, because pooled strings are reused
+      (!result || result==str) ? nullptr : make_shared_str(*result) }));
+  return result;
+}
+
+shared_str expression::apply(const shared_str& str) const {
   auto last = str->cbegin();
   boost::regex_iterator<shared_str::element_type::const_iterator>
     it(last, str->cend(), re), end;
@@ -236,7 +283,7 @@ shared_str expression::operator()(shared_str str) const {
   if (i || !sub) return str;
 
   static const std::decay_t<decltype(*sub)> no_sub("$&");
-  auto result = make_shared_str();
+  auto result = shared_str_pool::local().get();
   auto out = std::back_inserter(*result);
   const int mv = std::abs(m_i);
   const bool mn = (m_i<0);
@@ -257,6 +304,78 @@ shared_str expression::operator()(shared_str str) const {
   return result;
 }
 
+bool expression::is_plain_select() const noexcept {
+  return s && !p && !add && tag==none_tag && !sub && !re.empty()
+      && from==to && (from_i==-1 || from_i==0);
+}
+
+namespace {
+
+// patterns that refer to groups by number can't be combined
+bool mergeable_regex(const std::string& re) {
+  static const boost::regex group_ref(
+    R"(\\[1-9gk]|\(\?(P=|\(|R|[0-9]|[-+&|]))",
+    boost::regex_constants::nosubs);
+  return !boost::regex_search(re,group_ref);
+}
+
+}
+
+unsigned merge_selections(std::vector<expression>& exprs) {
+  unsigned n = 0, nsel = 0;
+  for (const expression& expr : exprs) {
+    if (!expr.is_plain_select() || expr.from!=exprs.front().from
+        || !mergeable_regex(expr.re.str())) break;
+    if (!expr.i) ++nsel;
+    ++n;
+  }
+  if (n < 2) return 0;
+
+  // histogram passes if all s regexes match and none of si regexes match
+  std::string re = "\\A";
+  for (unsigned i=0; i<n; ++i) {
+    if (exprs[i].i) continue;
+    re += "(?=(?s:.*?)(?:";
+    re += exprs[i].re.str();
+    re += "))";
+  }
+  if (nsel < n) {
+    re += "(?!(?s:.*?)(?:";
+    bool first = true;
+    for (unsigned i=0; i<n; ++i) {
+      if (!exprs[i].i) continue;
+      if (first) first = false;
+      else re += '|';
+      re += "(?:";
+      re += exprs[i].re.str();
+      re += ')';
+    }
+    re += "))";
+  }
+
+  try {
+    using namespace boost::regex_constants;
+    exprs.front().re = boost::regex(re,optimize|nosubs);
+  } catch (const boost::regex_error&) { return 0; }
+  exprs.front().cache = std::make_unique<expression::cache_t>();
+  exprs.front().i = false;
+  exprs.front().from_i = -1;
+  { // expression is not move assignable, so can't erase
+    std::vector<expression> merged;
+    merged.reserve(exprs.size()-n+1);
+    merged.emplace_back(std::move(exprs.front()));
+    for (auto it=exprs.begin()+n; it!=exprs.end(); ++it)
+      merged.emplace_back(std::move(*it));
+    exprs.swap(merged);
+  }
+
+  if (verbose(verbosity::exprs))
+    std::cout << "\033[35mMerged " << n << " selections:\033[0m "
+              << static_cast<const flags&>(exprs.front()) << '/'
+              << re << '/' << std::endl;
+  return n;
+}
+
 #define CASE(F) case flags::F : s << (*#F); break;
 std::ostream& operator<<(std::ostream& s, flags::field field) {
   switch (field) {
@@ -287,13 +406,16 @@ std::ostream& operator<<(std::ostream& s, const flags& f) {
 
 expression::expression(expression&& e)
 : flags(std::move(e)),
-  re(std::move(e.re)), sub(std::move(e.sub)), tag(e.tag) {
+  re(std::move(e.re)), sub(std::move(e.sub)), fcn(std::move(e.fcn)),
+  cache(std::move(e.cache)), tag(e.tag) {
   switch (e.tag) {
     case none_tag: break;
     case exprs_tag:
       new (&exprs)decltype(exprs)(std::move(e.exprs)); break;
     case hist_fcn_tag:
       new (&hist_fcn)decltype(hist_fcn)(std::move(e.hist_fcn)); break;
+    case hist_pred_tag:
+      new (&hist_pred)decltype(hist_pred)(std::move(e.hist_pred)); break;
     case canv_fcn_tag:
       new (&canv_fcn)decltype(canv_fcn)(std::move(e.canv_fcn)); break;
   }
@@ -302,11 +424,89 @@ expression::expression(expression&& e)
 
 template <typename T> void destroy(T& x) { x.~T(); }
 
+void print_cache_stats(
+  std::ostream& s, const std::vector<expression>& exprs, int level
+) {
+  for (const expression& expr : exprs) {
+    if (expr.cache) {
+      for (int i=0; i<level; ++i) s << "  ";
+      s << static_cast<const flags&>(expr)
+        << "\033[34m/\033[0m" << expr.re.str() << "\033[34m/\033[0m"
+        << " hits: " << expr.cache->hits
+        << ", misses: " << expr.cache->misses << '\n';
+    }
+    if (expr.tag==expression::exprs_tag)
+      print_cache_stats(s,expr.exprs,level+1);
+  }
+}
+
+bool has_predicates(const std::vector<expression>& exprs) {
+  for (const expression& expr : exprs) {
+    if (expr.tag==expression::hist_pred_tag) return true;
+    if (expr.tag==expression::exprs_tag && has_predicates(expr.exprs))
+      return true;
+  }
+  return false;
+}
+
+void program::compile(const std::vector<expression>& exprs, unsigned level) {
+  for (const expression& expr : exprs) {
+    const size_t m = code.size();
+    code.push_back({instr::match,(unsigned char)level,0,&expr});
+    if (expr.add) code.push_back({instr::concat,(unsigned char)level,0,&expr});
+    code.push_back({instr::set,(unsigned char)level,0,&expr});
+    switch (expr.tag) {
+      case expression::exprs_tag: compile(expr.exprs,level+1); break;
+      case expression::hist_fcn_tag:
+        code.push_back({instr::call,(unsigned char)level,0,&expr}); break;
+      case expression::hist_pred_tag:
+        code.push_back({instr::pred,(unsigned char)level,0,&expr}); break;
+      case expression::canv_fcn_tag:
+        code.push_back({instr::canv_call,(unsigned char)level,0,&expr}); break;
+      default: ;
+    }
+    code[m].skip = code.size();
+  }
+}
+
+std::ostream& operator<<(std::ostream& s, const program& prog) {
+  static const char* names[] {
+    "match", "concat", "set", "call", "pred", "canv"
+  };
+  for (size_t i=0, n=prog.code.size(); i<n; ++i) {
+    const auto& in = prog.code[i];
+    const expression& expr = *in.expr;
+    s << std::setw(4) << i << ' ';
+    for (unsigned l=in.level; l; --l) s << "  ";
+    s << "\033[32m" << std::left << std::setw(7) << names[in.op]
+      << std::right << "\033[0m";
+    switch (in.op) {
+      case program::instr::match:
+        s << static_cast<const flags&>(expr);
+        if (!expr.re.empty()) {
+          s << "\033[34m/\033[0m" << expr.re.str() << "\033[34m/\033[0m";
+          if (expr.sub) s << *expr.sub << "\033[34m/\033[0m";
+        }
+        if (expr.s) s << " else reject";
+        else s << " else goto " << in.skip;
+        break;
+      case program::instr::concat:
+        s << (expr.add==flags::prepend ? "before " : "after ") << expr.to;
+        break;
+      case program::instr::set: s << expr.to; break;
+      default: s << expr.fcn;
+    }
+    s << '\n';
+  }
+  return s;
+}
+
 expression::~expression() {
   switch (tag) {
     case none_tag: break;
     case exprs_tag: destroy(exprs); break;
     case hist_fcn_tag: destroy(hist_fcn); break;
+    case hist_pred_tag: destroy(hist_pred); break;
     case canv_fcn_tag: destroy(canv_fcn); break;
   }
 }
@@ -2,10 +2,21 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <mutex>
 
 #include <TDirectory.h>
+#include <TArrayD.h>
+#include <TArrayF.h>
 
+#include "hed/canv.hh"
 #include "hed/verbosity.hh"
+#include "hed/state.hh"
+#include "hed/summary.hh"
 
 #define TEST(var) \
   std::cout <<"\033[36m"<< #var <<"\033[0m"<< " = " << var << std::endl;
@@ -16,32 +27,54 @@ const char* get_file_str(const TDirectory* dir) {
   }
   return dir->GetName();
 }
-std::string get_path_str(const TDirectory* dir) {
+void get_path_str(const TDirectory* dir, std::string& str) {
   const TDirectory* m = dir->GetMotherDir();
-  if (!m) return { };
-  else if (!m->GetMotherDir()) return dir->GetName();
-  else return get_path_str(m) + "/" + dir->GetName();
+  if (!m) return;
+  if (m->GetMotherDir()) {
+    get_path_str(m,str);
+    str += '/';
+  }
+  str += dir->GetName();
 }
 
-std::string hist::init_impl(flags::field field) {
+void hist::init_impl(flags::field field, std::string& str) {
   switch (field) {
-    case flags::n: return h->GetName(); break;
-    case flags::t: return h->GetTitle(); break;
-    case flags::x: return h->GetXaxis()->GetTitle(); break;
-    case flags::y: return h->GetYaxis()->GetTitle(); break;
-    case flags::z: return h->GetZaxis()->GetTitle(); break;
-    case flags::d: return get_path_str(h->GetDirectory()); break;
-    case flags::f: return get_file_str(h->GetDirectory()); break;
-    default: return { };
+    // n, d, f are known from the key without reading the histogram
+    case flags::n: str = h ? h->GetName() : key->GetName(); break;
+    case flags::t: str = get()->GetTitle(); break;
+    case flags::x: str = get()->GetXaxis()->GetTitle(); break;
+    case flags::y: str = get()->GetYaxis()->GetTitle(); break;
+    case flags::z: str = get()->GetZaxis()->GetTitle(); break;
+    // copies detached from their directories keep the key
+    case flags::d: get_path_str(
+      key ? key->GetMotherDir() : h->GetDirectory(), str); break;
+    case flags::f: str = get_file_str(
+      key ? key->GetMotherDir() : h->GetDirectory()); break;
+    default: ;
   }
 }
 
+// field histories of finished applicators, kept to reuse their capacity
+thread_local std::vector<std::unique_ptr<applicator<hist>::field_history>>
+  applicator<hist>::free_fields;
+
 applicator<hist>::
 applicator(hist& h, shared_str& group): h(h), group(group) {
-  for (auto& field : fields) { field.emplace_back(); }
+  if (free_fields.empty()) fields = std::make_unique<field_history>();
+  else {
+    fields = std::move(free_fields.back());
+    free_fields.pop_back();
+  }
+  for (auto& field : *fields) { field.emplace_back(); }
+}
+
+applicator<hist>::~applicator() {
+  for (auto& field : *fields) field.clear();
+  free_fields.emplace_back(std::move(fields));
+  shared_str_pool::local().reset();
 }
 
-#define FIELD(F) std::get<flags::F-1>(fields).back()
+#define FIELD(F) std::get<flags::F-1>(*fields).back()
 
 shared_str& applicator<hist>::init_field(flags::field q, int i) {
   shared_str& str = at(q)[i];
@@ -55,42 +88,21 @@ shared_str& applicator<hist>::init_field(flags::field q, int i) {
   return str;
 }
 
-bool applicator<hist>::
-operator()(const std::vector<expression>& exprs, int level) {
-  if (!level && !group && exprs.empty()) {
-    group = h.init(flags::n);
+bool applicator<hist>::operator()(const program& prog) {
+  if (!group && prog.empty()) {
+    if (planning) group = make_shared_str(h.h ? h->GetName() : h.key->GetName());
+    else group = make_shared_str(h.get()->GetName());
     return true;
   }
 
+  // registers of the current expression
+  shared_str str, result;
   bool first = true;
-  for (const expression& expr : exprs) {
-    auto& field = at(expr.from);
-    int index = expr.from_i;
-    if (index<0) index += field.size(); // make index positive
-    if (index<0 || (unsigned(index))>field.size()) // overflow check
-      throw std::runtime_error("out of range field string version index");
-
-    auto& str = init_field(expr.from,index);
-    const auto to_i = at(expr.to).size()-1;
-    if (expr.from!=expr.to && expr.add) init_field(expr.to,to_i);
-    const auto& to = at(expr.to)[to_i];
-
-    auto result = expr(str);
-    const bool matched = !!result;
-
-    if (matched) {
-      switch (expr.add) {
-        case flags::no_add: break;
-        case flags::prepend:
-          result = make_shared_str(*result + *to); break;
-        case flags::append:
-          result = make_shared_str(*to + *result); break;
-      }
-    }
 
+  const auto print = [&](const program::instr& in, bool matched) {
+    const expression& expr = *in.expr;
     const bool new_str = (matched && (expr.to!=expr.from || result!=str));
-
-    if (verbose) if (
+    if ( !expression::quiet &&
       ( (verbose(verbosity::matched) && matched) ||
         (verbose(verbosity::not_matched) && !matched) ) &&
       ( expr.from!=expr.to || !expr.re.empty() || result!=str )
@@ -98,9 +110,9 @@ operator()(const std::vector<expression>& exprs, int level) {
       using std::cout;
       using std::endl;
 
-      if (!level && first) first = false, cout << "➜ ";
+      if (!in.level && first) first = false, cout << "➜ ";
       else cout << "  ";
-      for (int i=0; i<level; ++i) cout << "  ";
+      for (int i=0; i<in.level; ++i) cout << "  ";
       cout << static_cast<const flags&>(expr);
       if (!expr.re.empty()) {
         cout << "\033[34m/\033[0m"
@@ -112,47 +124,93 @@ operator()(const std::vector<expression>& exprs, int level) {
       if (new_str) cout << " \033[34m>\033[0m " << *result;
       cout << endl;
     }
+  };
+
+  const program::instr* const code = prog.code.data();
+  for (size_t pc=0, n=prog.code.size(); pc<n; ++pc) {
+    const program::instr& in = code[pc];
+    const expression& expr = *in.expr;
+    switch (in.op) {
+      case program::instr::match: {
+        auto& field = at(expr.from);
+        int index = expr.from_i;
+        if (index<0) index += field.size(); // make index positive
+        if (index<0 || (unsigned(index))>field.size()) // overflow check
+          throw std::runtime_error("out of range field string version index");
+
+        str = init_field(expr.from,index);
+        result = expr(str);
+        if (!result) {
+          if (verbose) print(in,false);
+          if (expr.s) return false;
+          pc = in.skip-1; // skip subexpressions and functions
+        }
+      } break;
+
+      case program::instr::concat: {
+        const auto to_i = at(expr.to).size()-1;
+        if (expr.from!=expr.to) init_field(expr.to,to_i);
+        const auto& to = at(expr.to)[to_i];
+
+        auto cat = shared_str_pool::local().get();
+        const auto& a = (expr.add==flags::prepend ? *result : *to);
+        const auto& b = (expr.add==flags::prepend ? *to : *result);
+        cat->reserve(a.size()+b.size());
+        cat->append(a).append(b);
+        result = std::move(cat);
+      } break;
+
+      case program::instr::set:
+        if (verbose) print(in,true);
+        if (expr.to!=expr.from || result!=str)
+          at(expr.to).emplace_back(result);
+        break;
 
-    if (matched) {
-      if (new_str)
-        at(expr.to).emplace_back(result);
-
-      if (!this->hook(expr,level+1)) return false; // virtual call
+      case program::instr::call:
+        if (planning && !plan_fcns) break;
+        expr.hist_fcn(h.get());
+        forget_summary(h.h);
+        break;
 
-    } else if (expr.s) return false;
-  } // end expressions loop
+      case program::instr::pred:
+        if (!expr.hist_pred(h.get())) return false;
+        break;
 
-  if (level) return true;
+      case program::instr::canv_call:
+        expr.canv_fcn(*canv);
+        for (const auto& h : *canv->hh) forget_summary(h.h);
+        break;
+    }
+  }
 
   // assign group
   // TODO: decide what to do if can expr changed group
   if (!(group = std::move(FIELD(g))))
     if (!(group = std::move(FIELD(n)))) // default g to n
       group = h.init(flags::n);
+  group = make_shared_str(*group); // may be from the pool
+  if (planning) return true;
+
+  // histogram passed selection, read it if it hasn't been read yet
+  h.get();
 
   // assign field values to the histogram
   if (FIELD(t)) h->SetTitle (FIELD(t)->c_str());
   if (FIELD(x)) h->SetXTitle(FIELD(x)->c_str());
   if (FIELD(y)) h->SetYTitle(FIELD(y)->c_str());
   if (FIELD(z)) h->SetZTitle(FIELD(z)->c_str());
-  if (FIELD(l)) h.legend = std::move(FIELD(l));
+  if (FIELD(l)) h.legend = make_shared_str(*FIELD(l));
 
   return true;
 }
 
 #undef FIELD
 
-bool applicator<hist>::hook(const expression& expr, int level) {
-  switch (expr.tag) {
-    case expression::exprs_tag: return operator()(expr.exprs,level);
-    case expression::hist_fcn_tag: expr.hist_fcn(h.h); break;
-    default: ;
-  }
-  return true;
-}
+bool applicator<hist>::planning = false;
+bool applicator<hist>::plan_fcns = false;
 
-bool hist::operator()(const std::vector<expression>& exprs, shared_str& group) {
-  return applicator<hist>(*this,group)(exprs);
+bool hist::operator()(const program& prog, shared_str& group) {
+  return applicator<hist>(*this,group)(prog);
 }
 
 bool edge_cmp(double a, double b) noexcept {
@@ -166,81 +224,239 @@ inline T& ffix(T& x) noexcept {
   return x;
 }
 
-void divide(TH1* ha, TH1* hb, bool divided_by_width=false) {
-  if (ha==hb) {
-    const unsigned n = ha->GetNbinsX()+2;
-    TArrayD *_e2 = ha->GetSumw2();
+namespace {
+
+// Same as ffix, but without branches, so that loops vectorize
+template <typename T>
+inline T fixed(T x) noexcept {
+  const T ax = std::abs(x);
+  return (ax >= std::numeric_limits<T>::min()
+       && ax <= std::numeric_limits<T>::max()) ? x : T(0);
+}
+
+bool same_axis(const TAxis* a, const TAxis* b) {
+  const int n = a->GetNbins();
+  if (n != b->GetNbins()
+      || !edge_cmp(a->GetXmin(),b->GetXmin())
+      || !edge_cmp(a->GetXmax(),b->GetXmax())) return false;
+  if (a->IsVariableBinSize() || b->IsVariableBinSize())
+    for (int i=2; i<=n; ++i)
+      if (!edge_cmp(a->GetBinLowEdge(i),b->GetBinLowEdge(i))) return false;
+  return true;
+}
+bool same_binning(const TH1* a, const TH1* b) {
+  const int dim = a->GetDimension();
+  return dim == b->GetDimension()
+    && same_axis(a->GetXaxis(),b->GetXaxis())
+    && (dim < 2 || same_axis(a->GetYaxis(),b->GetYaxis()))
+    && (dim < 3 || same_axis(a->GetZaxis(),b->GetZaxis()));
+}
+
+inline double* sumw2(TH1* h) noexcept {
+  return h->GetSumw2N() ? h->GetSumw2()->GetArray() : nullptr;
+}
+
+// Call f with the contiguous bin contents array of h, including
+// under- and overflow cells.
+// Histograms with storage other than double or float are copied
+// into a temporary buffer and back.
+template <typename F>
+void with_bins(TH1* h, F&& f) {
+  if (auto* arr = dynamic_cast<TArrayD*>(h)) f(arr->GetArray());
+  else if (auto* arr = dynamic_cast<TArrayF*>(h)) f(arr->GetArray());
+  else {
+    const int n = h->GetNcells();
+    std::vector<double> bins(n);
+    for (int i=0; i<n; ++i) bins[i] = h->GetBinContent(i);
+    f(bins.data());
+    for (int i=0; i<n; ++i) h->SetBinContent(i,bins[i]);
+  }
+}
+template <typename F>
+void with_bins(TH1* a, TH1* b, F&& f) {
+  with_bins(a,[&](auto* pa){
+    if (a==b) f(pa,pa);
+    else with_bins(b,[&](auto* pb){ f(pa,pb); });
+  });
+}
+
+// Kernels over n cells. Errors squared of the first histogram are
+// updated if e2a is not null. If e2b is null, errors of the second
+// histogram are taken to be Poisson.
+
+template <typename A, typename B>
+void ratio_kernel(
+  A* a, const B* b, double* e2a, const double* e2b, unsigned n
+) noexcept {
+  if (e2a && e2b) {
     for (unsigned i=0; i<n; ++i) {
-      if (_e2) {
-        const auto c = ha->GetBinContent(i);
-        ffix((*_e2)[i] *= (1./(c*c)));
-      }
-      ha->SetBinContent(i,1);
+      const double ai = a[i], bi = b[i], c = fixed(ai/bi);
+      e2a[i] = fixed(bi==0 ? 0. : (e2a[i]/(ai*ai) + e2b[i]/(bi*bi))*c*c);
+      a[i] = c;
     }
-    return;
+  } else { // TODO: divide without errors
+    for (unsigned i=0; i<n; ++i)
+      a[i] = fixed(double(a[i])/double(b[i]));
+  }
+}
+
+template <typename A, typename B>
+void product_kernel(
+  A* a, const B* b, double* e2a, const double* e2b, unsigned n
+) noexcept {
+  if (e2a && e2b) {
+    for (unsigned i=0; i<n; ++i) {
+      const double ai = a[i], bi = b[i];
+      e2a[i] = e2a[i]*bi*bi + e2b[i]*ai*ai;
+      a[i] = ai*bi;
+    }
+  } else if (e2a) {
+    for (unsigned i=0; i<n; ++i) {
+      const double ai = a[i], bi = b[i];
+      e2a[i] = e2a[i]*bi*bi + std::abs(bi)*ai*ai;
+      a[i] = ai*bi;
+    }
+  } else {
+    for (unsigned i=0; i<n; ++i) a[i] = double(a[i])*double(b[i]);
   }
+}
 
-  const unsigned na = ha->GetNbinsX()+2, nb = hb->GetNbinsX()+2;
-  std::vector<double> _a(na), _b(nb);
-  for (unsigned i=0; i<na; ++i) _a[i] = ha->GetBinContent(i);
-  for (unsigned i=0; i<nb; ++i) _b[i] = hb->GetBinContent(i);
-  TArrayD *_e2a = ha->GetSumw2(), *_e2b = hb->GetSumw2();
-  const TAxis *xa = ha->GetXaxis(), *xb = hb->GetXaxis();
-
-  const bool eq_n = (na==nb);
-  const bool eq_range = edge_cmp(xa->GetXmin(),xb->GetXmin())
-                     && edge_cmp(xa->GetXmax(),xb->GetXmax());
-  const bool both_uniform
-    = !xa->IsVariableBinSize() && !xb->IsVariableBinSize();
-
-  bool eq_bins = eq_n && eq_range;
-  if (eq_bins && !both_uniform) {
-    for (unsigned i=2; i<na; ++i)
-      if (!edge_cmp(xa->GetBinLowEdge(i),xb->GetBinLowEdge(i))) {
-        eq_bins = false;
-        break;
+template <typename A, typename B>
+void sum_kernel(
+  A* a, const B* b, double c, double* e2a, const double* e2b, unsigned n
+) noexcept {
+  const double c2 = c*c;
+  if (e2a && e2b) {
+    for (unsigned i=0; i<n; ++i) {
+      e2a[i] += c2*e2b[i];
+      a[i] += c*b[i];
+    }
+  } else if (e2a) {
+    for (unsigned i=0; i<n; ++i) {
+      e2a[i] += c2*std::abs(double(b[i]));
+      a[i] += c*b[i];
+    }
+  } else {
+    for (unsigned i=0; i<n; ++i) a[i] += c*b[i];
+  }
+}
+
+// Overlaps of bins of axis a with bins of axis b, for every bin of a,
+// including under- and overflow
+struct overlap_map {
+  struct overlap {
+    unsigned j; // bin of b
+    double frac_b, frac_a; // overlap as fractions of widths of bins j and i
+  };
+  std::vector<unsigned> offsets; // overlaps of bin i are [offsets[i],offsets[i+1])
+  std::vector<overlap> overlaps;
+  bool empty = true; // no overlaps between regular bins
+
+  overlap_map(const TAxis* a, const TAxis* b) {
+    const unsigned na = a->GetNbins(), nb = b->GetNbins();
+    offsets.reserve(na+3);
+    offsets.push_back(0);
+    if (edge_cmp(a->GetXmin(),b->GetXmin())) overlaps.push_back({0,1,1});
+    offsets.push_back(overlaps.size());
+
+    for (unsigned i=1, j=1; i<=na; ++i) {
+      const double a1 = a->GetBinLowEdge(i), a2 = a->GetBinUpEdge(i),
+                   wa = a2 - a1;
+      for (; j<=nb; ++j) {
+        const double b1 = b->GetBinLowEdge(j), b2 = b->GetBinUpEdge(j),
+                     wb = b2 - b1;
+        const double ov = std::min(a2,b2) - std::max(a1,b1);
+        if (ov > 1e-5*std::min(wa,wb)) {
+          overlaps.push_back({j,ov/wb,ov/wa});
+          empty = false;
+        }
+        if (b2 > a2 && !edge_cmp(a2,b2)) break; // b bin continues into i+1
       }
+      offsets.push_back(overlaps.size());
+    }
+
+    if (edge_cmp(a->GetXmax(),b->GetXmax())) overlaps.push_back({nb+1,1,1});
+    offsets.push_back(overlaps.size());
   }
+};
+
+// Overlap maps are reused for all pairs of axes with the same binnings
+const overlap_map& get_overlap_map(const TAxis* a, const TAxis* b) {
+  using axis_key = std::tuple<int,double,double,uint64_t>;
+  auto key = [](const TAxis* ax) -> axis_key {
+    fnv1a edges;
+    const TArrayD* xbins = ax->GetXbins();
+    if (xbins->GetSize())
+      edges.add(xbins->GetArray(),xbins->GetSize()*sizeof(Double_t));
+    return { ax->GetNbins(), ax->GetXmin(), ax->GetXmax(), edges.value() };
+  };
+  static std::map<std::pair<axis_key,axis_key>,overlap_map> maps;
+  static std::mutex mx;
+
+  auto k = std::make_pair(key(a),key(b));
+  std::lock_guard<std::mutex> lock(mx);
+  auto it = maps.find(k);
+  if (it==maps.end()) it = maps.emplace(std::move(k),overlap_map(a,b)).first;
+  return it->second;
+}
 
-#define DIV_NEW_ERR \
-  ffix(e2a = ( b==0 ? 0 : (e2a/(a*a) + e2b/(b*b))*c*c )); \
-
-  if (eq_bins) { // equal binning case ------------------------------
-    for (unsigned i=0; i<na; ++i) {
-      const auto& a = _a[i];
-      const auto& b = _b[i];
-      auto c = a/b;
-      ha->SetBinContent(i, ffix(c));
-      if (_e2a && _e2b) {
-              auto& e2a = (*_e2a)[i];
-        const auto& e2b = (*_e2b)[i];
-        DIV_NEW_ERR
-      } // TODO: divide without errors
+// a /= b, where b is rebinned onto bins of a
+template <typename A, typename B>
+void rebin_ratio_kernel(
+  A* a, const B* b, double* e2a, const double* e2b,
+  const overlap_map& m, bool divided_by_width
+) noexcept {
+  const unsigned n = m.offsets.size()-1;
+  for (unsigned i=0; i<n; ++i) {
+    double bi = 0, e2bi = 0;
+    for (unsigned k=m.offsets[i], end=m.offsets[i+1]; k<end; ++k) {
+      const auto& o = m.overlaps[k];
+      const double w = divided_by_width ? o.frac_a : o.frac_b;
+      bi += w*b[o.j];
+      if (e2b) e2bi += w*w*e2b[o.j];
     }
-    return;
-  } else if (eq_range) { // equal axis ranges -----------------------
-    if (both_uniform) {
-    if ((nb>na) && !((nb-2)%(na-2))) {
-      double b=0, e2b=0;
-      const unsigned nf = (nb-2)/(na-2);
-      for (unsigned ia=0, ib=0; ib<nb; ++ib) {
-        b += _b[ib];
-        if (_e2b) e2b += (*_e2b)[ib];
-        if (!(ib%nf) || ib==nb-1) {
-          const auto& a = _a[ia];
-          auto c = a/b;
-          if (divided_by_width) c *= nf;
-          ha->SetBinContent(ia, ffix(c));
-          if (_e2a) {
-            auto& e2a = (*_e2a)[ia];
-            DIV_NEW_ERR
-          } // TODO: divide without errors
-          ++ia; b = 0; e2b=0;
+    const double ai = a[i], c = fixed(ai/bi);
+    if (e2a && e2b) // TODO: divide without errors
+      e2a[i] = fixed(bi==0 ? 0. : (e2a[i]/(ai*ai) + e2bi/(bi*bi))*c*c);
+    a[i] = c;
+  }
+}
+
+} // end namespace
+
+void divide(TH1* ha, TH1* hb, bool divided_by_width=false) {
+  if (is_profile(ha) || is_profile(hb)) { ha->Divide(hb); return; }
+  if (ha==hb) {
+    double* e2 = sumw2(ha);
+    with_bins(ha,[&](auto* a){
+      for (unsigned i=0, n=ha->GetNcells(); i<n; ++i) {
+        if (e2) {
+          const double c = a[i];
+          e2[i] = fixed(e2[i]*(1./(c*c)));
         }
+        a[i] = 1;
       }
+    });
+    return;
+  }
+
+  if (same_binning(ha,hb)) { // equal binning case ------------------
+    double *e2a = sumw2(ha), *e2b = sumw2(hb);
+    with_bins(ha,hb,[&](auto* a, auto* b){
+      ratio_kernel(a,b,e2a,e2b,ha->GetNcells());
+    });
+    return;
+  }
+
+  if (ha->GetDimension()==1 && hb->GetDimension()==1) { // rebin b
+    const overlap_map& m = get_overlap_map(ha->GetXaxis(),hb->GetXaxis());
+    if (!m.empty) {
+      double *e2a = sumw2(ha), *e2b = sumw2(hb);
+      with_bins(ha,hb,[&](auto* a, auto* b){
+        rebin_ratio_kernel(a,b,e2a,e2b,m,divided_by_width);
+      });
       return;
-    } // TODO: divide (na>nb)
-    } // TODO: divide non-uniform
+    }
   }
 
   std::cerr << "\033[31mdivide\033[0m: bin edges don't match for "
@@ -248,6 +464,48 @@ void divide(TH1* ha, TH1* hb, bool divided_by_width=false) {
     << std::endl;
 }
 
-void multiply(TH1* a, TH1* b) { a->Multiply(b); }
-void hadd(TH1* a, TH1* b, double c) { a->Add(b,c); }
+void multiply(TH1* a, TH1* b) {
+  if (!same_binning(a,b) || is_profile(a) || is_profile(b)) {
+    a->Multiply(b);
+    return;
+  }
+  if (!a->GetSumw2N() && b->GetSumw2N()) a->Sumw2();
+  const double entries = a->GetEntries();
+  a->SetMinimum();
+  a->SetMaximum();
+  double *e2a = sumw2(a), *e2b = sumw2(b);
+  with_bins(a,b,[&](auto* pa, auto* pb){
+    product_kernel(pa,pb,e2a,e2b,a->GetNcells());
+  });
+  a->ResetStats();
+  a->SetEntries(entries); // as TH1::Multiply
+}
+
+void hadd(TH1* a, TH1* b, double c) {
+  if (!same_binning(a,b) || is_profile(a) || is_profile(b)) {
+    a->Add(b,c);
+    return;
+  }
+  if (!a->GetSumw2N() && b->GetSumw2N()) a->Sumw2();
+  // stats as in TH1::Add: reset if c < 0, sum of weights squared scales by c^2
+  const bool reset_stats = c < 0;
+  const double entries = std::abs(a->GetEntries() + c*b->GetEntries());
+  double sa[TH1::kNstat], sb[TH1::kNstat];
+  if (!reset_stats) {
+    a->GetStats(sa);
+    b->GetStats(sb);
+    for (int i=0; i<TH1::kNstat; ++i) sa[i] += (i==1 ? c*c : c)*sb[i];
+  }
 
+  a->SetMinimum();
+  a->SetMaximum();
+  double *e2a = sumw2(a), *e2b = sumw2(b);
+  with_bins(a,b,[&](auto* pa, auto* pb){
+    sum_kernel(pa,pb,c,e2a,e2b,a->GetNcells());
+  });
+  if (reset_stats) a->ResetStats();
+  else {
+    a->PutStats(sa);
+    a->SetEntries(entries);
+  }
+}
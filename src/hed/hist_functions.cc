@@ -1,4 +1,12 @@
 #include <string>
+#include <map>
+#include <cctype>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <algorithm>
 
 #include <dlfcn.h>
 
@@ -9,6 +17,8 @@
 #include <TPaveStats.h>
 
 #include "function_map.hh"
+#include "hed/hist.hh"
+#include "hed/summary.hh"
 
 using base = function_map<TH1*>;
 
@@ -32,7 +42,7 @@ void for_axes(const std::string& arg, TH1* h, F f) {
   }
 }
 
-F(norm,TIE(1,double),1) { a->Scale(arg<0>()/a->Integral("width")); }
+F(norm,TIE(1,double),1) { a->Scale(arg<0>()/summary(a).integral_width); }
 F(scale,TIE(1,double,std::string),{}) { a->Scale(arg<0>(),arg<1>().c_str()); }
 
 F0(min,double) { a->SetMinimum(arg<0>()); }
@@ -102,7 +112,7 @@ F(stats,TIE(2,std::string,Float_t),TIE({{}},0.65)) {
   if (arg<0>().empty()) {
     a->SetStats(false);
   } else {
-    gStyle->SetOptStat(arg<0>().c_str());
+    set_global([opt=arg<0>()]{ gStyle->SetOptStat(opt.c_str()); });
     a->SetStats(true);
     auto* stat_box = static_cast<TPaveStats*>(a->FindObject("stats"));
     if (stat_box) stat_box->SetFillColorAlpha(0,arg<1>());
@@ -111,14 +121,25 @@ F(stats,TIE(2,std::string,Float_t),TIE({{}},0.65)) {
 
 F(opt,TIE(1,std::string),{}) { a->SetOption(arg<0>().c_str()); }
 F(val_fmt,TIE(1,std::string),{}) {
-  gStyle->SetPaintTextFormat(arg<0>().c_str());
+  set_global([fmt=arg<0>()]{ gStyle->SetPaintTextFormat(fmt.c_str()); });
 }
 
+// Histograms passed to a plugin with a run_batch entry point,
+// which is called once for all of them by run_batches()
+struct batch {
+  std::shared_ptr<void> dl;
+  void(*run_batch)(TH1**,size_t);
+  std::unordered_set<TH1*> pending;
+  std::mutex mx; // functions are applied on scanning threads
+};
+std::vector<std::shared_ptr<batch>> batches;
+
 struct load final: public base,
   private interpreted_args<1,std::string,std::string>
 {
   const std::shared_ptr<void> dl;
   void(*run)(TH1*);
+  std::shared_ptr<batch> b; // null if the plugin has no run_batch
 
   template <typename F>
   void _dlsym(F& f, const char* name) {
@@ -134,10 +155,21 @@ struct load final: public base,
     void(*init)(const std::string&);
     _dlsym(init,"init");
     _dlsym(run,"run");
+    if (void* f = dlsym(dl.get(),"run_batch")) {
+      b = std::make_shared<batch>();
+      b->dl = dl;
+      b->run_batch = (void(*)(TH1**,size_t)) f;
+      batches.push_back(b);
+    } else dlerror(); // optional symbol
     init(arg<1>());
   }
 
-  void operator()(type h) const { run(h); }
+  void operator()(type h) const {
+    if (b) {
+      std::lock_guard<std::mutex> lock(b->mx);
+      b->pending.insert(h);
+    } else run(h);
+  }
 };
 
 } // ----------------------------------------------------------------
@@ -174,3 +206,130 @@ MAP {
   ADD(load)
 };
 
+
+// Predicates ---------------------------------------------------------
+// Expressions calling these drop histograms for which they are false
+
+using pred_base = function_map<TH1*,bool>;
+
+namespace hist_pred_def {
+
+// compare a summary value: cut integral > 1e-3
+struct cut final: public pred_base {
+  double hist_summary::* field;
+  enum op_t { lt, le, gt, ge, eq, ne } op;
+  double val;
+
+  cut(string_view arg_str) {
+    static const std::map<string_view,double hist_summary::*> fields {
+      {"integral", &hist_summary::integral},
+      {"integral_width", &hist_summary::integral_width},
+      {"min", &hist_summary::min},
+      {"max", &hist_summary::max},
+      {"min_err", &hist_summary::min_err},
+      {"max_err", &hist_summary::max_err},
+      {"min_pos", &hist_summary::min_pos}
+    };
+    auto s = arg_str.begin(), end = arg_str.end();
+    auto skip_space = [&]{ while (s!=end && (*s==' '||*s=='\t')) ++s; };
+
+    skip_space();
+    const auto name_begin = s;
+    while (s!=end && (std::isalnum(*s) || *s=='_')) ++s;
+    const auto it = fields.find({name_begin,size_t(s-name_begin)});
+    if (it==fields.end()) throw ivanp::error(
+      "unknown field \"",string_view(name_begin,s-name_begin),'\"');
+    field = it->second;
+
+    skip_space();
+    static const std::map<string_view,op_t> ops {
+      {"<",lt}, {"<=",le}, {">",gt}, {">=",ge}, {"==",eq}, {"!=",ne}
+    };
+    const auto op_begin = s;
+    while (s!=end && std::strchr("<>=!",*s)) ++s;
+    const auto op_it = ops.find({op_begin,size_t(s-op_begin)});
+    if (op_it==ops.end()) throw ivanp::error("expected comparison operator");
+    op = op_it->second;
+
+    skip_space();
+    std::string num(s,end);
+    size_t pos;
+    val = std::stod(num,&pos);
+    if (num.find_first_not_of(" \t",pos)!=std::string::npos)
+      throw ivanp::error("trailing characters after number");
+  }
+
+  bool operator()(TH1* h) const {
+    const double x = summary(h).*field;
+    switch (op) {
+      case lt: return x <  val;
+      case le: return x <= val;
+      case gt: return x >  val;
+      case ge: return x >= val;
+      case eq: return x == val;
+      case ne: return x != val;
+    }
+    return false;
+  }
+};
+
+// true if any bin has non-zero content
+struct nonzero final: public pred_base {
+  nonzero(string_view arg_str) {
+    if (!arg_str.empty()) throw ivanp::error("unexpected arguments");
+  }
+  bool operator()(TH1* h) const { return summary(h).nonzero; }
+};
+
+}
+
+void run_batches(const std::vector<TH1*>& hs) {
+  std::vector<TH1*> args;
+  for (const auto& b : hist_fcn_def::batches) {
+    if (b->pending.empty()) continue;
+    args.clear();
+    for (TH1* h : hs)
+      if (b->pending.count(h)) args.push_back(h);
+    b->pending.clear();
+    if (args.empty()) continue;
+    b->run_batch(args.data(),args.size());
+    for (TH1* h : args) forget_summary(h);
+  }
+}
+
+void drop_batches() {
+  for (const auto& b : hist_fcn_def::batches) b->pending.clear();
+}
+
+void forget_batches(const TH1* h) {
+  for (const auto& b : hist_fcn_def::batches) {
+    std::lock_guard<std::mutex> lock(b->mx);
+    b->pending.erase(const_cast<TH1*>(h));
+  }
+}
+
+thread_local size_t scan_task_index = 0;
+
+namespace {
+std::vector<std::pair<size_t,std::function<void()>>> globals;
+std::mutex globals_mx;
+}
+
+void set_global(std::function<void()> f) {
+  if (!expression::threaded) { f(); return; }
+  std::lock_guard<std::mutex> lock(globals_mx);
+  globals.emplace_back(scan_task_index,std::move(f));
+}
+
+void apply_globals() {
+  // calls of every task were queued by one thread, in order
+  std::stable_sort(globals.begin(),globals.end(),
+    [](const auto& a, const auto& b){ return a.first < b.first; });
+  for (auto& g : globals) g.second();
+  globals.clear();
+}
+
+template <> pred_base::map_type pred_base::all {
+  { "cut", &fcn_factory<hist_pred_def::cut> },
+  { "nonzero", &fcn_factory<hist_pred_def::nonzero> }
+};
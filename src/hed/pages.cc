@@ -0,0 +1,269 @@
+#include "hed/pages.hh"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "error.hh"
+
+page_dir::page_dir(const std::string& ofname): _path(ofname+".pages.XXXXXX") {
+  if (!mkdtemp(&_path[0])) throw ivanp::error(
+    "cannot create directory ",_path);
+}
+
+page_dir::~page_dir() {
+  if (DIR* dir = opendir(_path.c_str())) {
+    while (const dirent* f = readdir(dir)) {
+      if (f->d_name[0]=='.') continue;
+      std::remove((_path+'/'+f->d_name).c_str());
+    }
+    closedir(dir);
+  }
+  rmdir(_path.c_str());
+}
+
+std::string page_dir::file(unsigned i) const {
+  char name[16];
+  snprintf(name,sizeof(name),"/%06u.pdf",i);
+  return _path + name;
+}
+
+namespace {
+
+bool write_all(int fd, const void* buf, size_t n) {
+  for (const char* p = static_cast<const char*>(buf); n; ) {
+    const ssize_t m = write(fd,p,n);
+    if (m < 0) return false;
+    p += m; n -= m;
+  }
+  return true;
+}
+
+int run(const std::vector<std::string>& args) {
+  std::vector<char*> argv;
+  argv.reserve(args.size()+1);
+  for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+  argv.push_back(nullptr);
+
+  std::cout.flush();
+  const pid_t pid = fork();
+  if (pid < 0) throw ivanp::error("fork() failed");
+  if (pid == 0) {
+    execvp(argv[0],argv.data());
+    std::cerr << "\033[31mcannot run " << argv[0] << "\033[0m" << std::endl;
+    _exit(127);
+  }
+  int status;
+  if (waitpid(pid,&status,0) < 0) return -1;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Postscript string for a pdfmark title.
+// Printable ASCII is written as a literal string with ()\\ escaped,
+// anything else as a UTF-16BE hex string with a byte order mark.
+std::string ps_str(const std::string& str) {
+  std::string out;
+  if (std::all_of(str.begin(),str.end(),
+        [](char c){ return c>=' ' && c<='~'; })) {
+    out.reserve(str.size()+2);
+    out += '(';
+    for (char c : str) {
+      if (c=='(' || c==')' || c=='\\') out += '\\';
+      out += c;
+    }
+    out += ')';
+    return out;
+  }
+
+  static const char* hex = "0123456789ABCDEF";
+  auto put = [&](unsigned u){ // one UTF-16 unit
+    for (int shift=12; shift>=0; shift-=4) out += hex[(u>>shift)&0xF];
+  };
+  out.reserve(str.size()*4+6);
+  out += "<FEFF";
+  for (size_t i=0, n=str.size(); i<n; ) {
+    // decode UTF-8, invalid bytes become U+FFFD
+    const unsigned char c = str[i];
+    unsigned len = c<0x80 ? 1 : (c>>5)==0x6 ? 2 : (c>>4)==0xE ? 3
+                 : (c>>3)==0x1E ? 4 : 0;
+    unsigned cp = len==1 ? c : len==2 ? (c&0x1F) : len==3 ? (c&0x0F)
+                : (c&0x07);
+    if (!len || i+len > n) len = 0;
+    for (unsigned k=1; k<len; ++k) {
+      const unsigned char ck = str[i+k];
+      if ((ck>>6)!=0x2) { len = 0; break; }
+      cp = (cp<<6) | (ck&0x3F);
+    }
+    if (!len || cp>0x10FFFF || (cp>=0xD800 && cp<0xE000)) {
+      cp = 0xFFFD;
+      len = 1;
+    }
+    i += len;
+
+    if (cp < 0x10000) put(cp);
+    else {
+      cp -= 0x10000;
+      put(0xD800 | (cp>>10));
+      put(0xDC00 | (cp&0x3FF));
+    }
+  }
+  out += '>';
+  return out;
+}
+
+} // end namespace
+
+std::vector<std::pair<bool,std::string>> fork_pages(
+  unsigned npages, unsigned njobs,
+  const std::function<bool(unsigned,std::string&)>& draw
+) {
+  std::vector<std::pair<bool,std::string>> drawn(npages);
+  if (njobs < 2) {
+    for (unsigned i=0; i<npages; ++i)
+      drawn[i].first = draw(i,drawn[i].second);
+    return drawn;
+  }
+  if (njobs > npages) njobs = npages;
+  std::cout.flush();
+
+  struct child_t {
+    pid_t pid;
+    int fd; // read end of pipe
+    std::string buf; // incomplete record
+  };
+  std::vector<child_t> children;
+  for (unsigned k=0; k<njobs; ++k) {
+    int fd[2];
+    if (pipe(fd)) throw ivanp::error("pipe() failed");
+    const pid_t pid = fork();
+    if (pid < 0) throw ivanp::error("fork() failed");
+
+    if (pid == 0) { // child draws every njobs-th page
+      close(fd[0]);
+      int status = 0;
+      try {
+        std::string title;
+        for (uint32_t i=k; i<npages; i+=njobs) {
+          title.clear();
+          if (!draw(i,title)) continue;
+          const uint32_t len = title.size();
+          if (!( write_all(fd[1],&i,sizeof(i))
+              && write_all(fd[1],&len,sizeof(len))
+              && write_all(fd[1],title.data(),len) ))
+            throw ivanp::error("cannot write to pipe");
+        }
+      } catch (const std::exception& e) {
+        std::cerr <<"\033[31m"<< e.what() <<"\033[0m"<< std::endl;
+        status = 1;
+      }
+      std::cout.flush();
+      close(fd[1]);
+      _exit(status); // skip destructors of the parent's objects
+    }
+
+    close(fd[1]);
+    children.push_back({pid,fd[0],{}});
+  }
+
+  // read all pipes as data arrives, so no child blocks on a full pipe
+  try {
+    std::vector<pollfd> fds;
+    fds.reserve(children.size());
+    for (const auto& child : children) fds.push_back({child.fd,POLLIN,0});
+
+    char buf[1<<12];
+    for (unsigned nopen = fds.size(); nopen; ) {
+      if (poll(fds.data(),fds.size(),-1) < 0) {
+        if (errno==EINTR) continue;
+        throw ivanp::error("poll() failed");
+      }
+      for (unsigned k=0; k<fds.size(); ++k) {
+        if (fds[k].fd < 0 || !fds[k].revents) continue;
+        auto& child = children[k];
+        const ssize_t m = read(child.fd,buf,sizeof(buf));
+        if (m < 0) {
+          if (errno==EINTR) continue;
+          throw ivanp::error("cannot read from pipe");
+        }
+        if (m == 0) { // end of file
+          if (!child.buf.empty())
+            throw ivanp::error("bad page record from drawing process");
+          close(child.fd);
+          child.fd = fds[k].fd = -1;
+          --nopen;
+          continue;
+        }
+
+        // record: page index, title length, title
+        auto& b = child.buf;
+        b.append(buf,m);
+        size_t pos = 0;
+        for (uint32_t i, len; b.size()-pos >= sizeof(i)+sizeof(len); ) {
+          memcpy(&i,b.data()+pos,sizeof(i));
+          memcpy(&len,b.data()+pos+sizeof(i),sizeof(len));
+          if (i >= npages)
+            throw ivanp::error("bad page record from drawing process");
+          const size_t head = sizeof(i)+sizeof(len);
+          if (b.size()-pos-head < len) break;
+          drawn[i] = { true, b.substr(pos+head,len) };
+          pos += head+len;
+        }
+        b.erase(0,pos);
+      }
+    }
+  } catch (...) {
+    for (auto& child : children) {
+      if (child.fd >= 0) close(child.fd);
+      kill(child.pid,SIGTERM);
+      waitpid(child.pid,nullptr,0);
+    }
+    throw;
+  }
+
+  bool ok = true;
+  for (auto& child : children) {
+    int status;
+    if (waitpid(child.pid,&status,0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status)) ok = false;
+  }
+  if (!ok) throw ivanp::error("drawing process failed");
+
+  return drawn;
+}
+
+void assemble_pdf(const std::string& ofname, const std::vector<page>& pages) {
+  if (pages.empty()) return;
+
+  const std::string marks_name = ofname + ".pdfmarks";
+  {
+    std::ofstream marks(marks_name);
+    unsigned i = 0;
+    for (const auto& p : pages)
+      marks << "[/Title " << ps_str(p.title)
+            << " /Page " << ++i << " /OUT pdfmark\n";
+    if (!marks) throw ivanp::error("cannot write ",marks_name);
+  }
+
+  std::vector<std::string> args {
+    "gs", "-q", "-dBATCH", "-dNOPAUSE", "-dSAFER",
+    "-sDEVICE=pdfwrite", "-sOutputFile="+ofname
+  };
+  args.reserve(args.size()+pages.size()+1);
+  for (const auto& p : pages) args.push_back(p.file);
+  args.push_back(marks_name);
+
+  const int status = run(args);
+  std::remove(marks_name.c_str());
+  if (status) throw ivanp::error("gs failed to assemble ",ofname);
+}
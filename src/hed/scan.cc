@@ -0,0 +1,161 @@
+#include "hed/scan.hh"
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <algorithm>
+#include <cstring>
+
+#include <TROOT.h>
+#include <TKey.h>
+
+#include "error.hh"
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+// Histogram keys from a single directory, scanned as one unit of work
+struct scan_task {
+  unsigned file;
+  std::string path; // directory path within the file
+  std::vector<std::pair<std::string,Short_t>> keys; // name, cycle
+};
+
+constexpr unsigned task_max_keys = 64;
+
+// Split a file into tasks in the order of the serial scan.
+// Only directory key lists are read here, histograms are read by workers.
+void plan(
+  TDirectory* dir, unsigned file, const std::string& path,
+  std::vector<scan_task>& tasks
+) {
+  timer t(timer::keys);
+  bool hists = false; // last task is from this directory
+  for (TKey& key : get_keys(dir)) {
+    const TClass* key_class = get_class(key);
+
+    if (key_class->InheritsFrom(TH1::Class())) { // HIST
+      if (!hists || tasks.back().keys.size() >= task_max_keys)
+        tasks.push_back({file,path,{}}), hists = true;
+      tasks.back().keys.emplace_back(key.GetName(),key.GetCycle());
+
+    } else if (key_class->InheritsFrom(TDirectory::Class())) { // DIR
+      TDirectory* subdir;
+      { timer t(timer::read);
+        subdir = read_key<TDirectory>(key);
+      }
+      plan(subdir, file,
+        path.empty() ? std::string(key.GetName()) : path+'/'+key.GetName(),
+        tasks);
+      hists = false;
+    }
+  }
+}
+
+} // end namespace
+
+TKey* key_reopener::operator()(TKey* key) {
+  const TFile* orig = key->GetFile();
+  auto it = std::find_if(files.begin(),files.end(),
+    [orig](const auto& f){ return f.first==orig; });
+  if (it==files.end()) {
+    timer t(timer::open);
+    files.emplace_back(orig,std::make_unique<TFile>(orig->GetName()));
+    it = files.end()-1;
+    if (it->second->IsZombie()) throw ivanp::error(
+      "cannot reopen file ",orig->GetName());
+  }
+
+  // path within the file follows ":/" in the directory path
+  const char* path = strstr(key->GetMotherDir()->GetPath(),":/");
+  path = path ? path+2 : "";
+  TDirectory* dir = *path ? it->second->GetDirectory(path) : it->second.get();
+  TKey* copy = dir ? dir->GetKey(key->GetName(),key->GetCycle()) : nullptr;
+  if (!copy) throw ivanp::error(
+    "cannot find key ",key->GetName(),';',key->GetCycle(),
+    " in reopened file ",orig->GetName());
+  return copy;
+}
+
+std::vector<scan_result> scan_parallel(
+  const std::vector<const char*>& ifnames,
+  const program& prog, unsigned njobs,
+  std::vector<std::unique_ptr<TFile>>& files
+) {
+  ROOT::EnableThreadSafety();
+
+  std::vector<scan_task> tasks;
+  for (unsigned i=0, n=ifnames.size(); i<n; ++i) {
+    timer t(timer::open);
+    TFile f(ifnames[i]);
+    if (f.IsZombie()) throw ivanp::error("cannot open file ",ifnames[i]);
+    cout << "\033[34mInput file:\033[0m " << f.GetName() << endl;
+    plan(&f,i,{},tasks);
+  }
+
+  if (njobs > tasks.size()) njobs = tasks.size();
+  std::vector<scan_result> results(tasks.size());
+  std::vector<std::vector<std::unique_ptr<TFile>>> worker_files(njobs);
+  std::atomic<size_t> next_task(0);
+  std::exception_ptr err;
+  std::mutex err_mx;
+
+  auto work = [&](unsigned w) {
+    std::vector<TFile*> handles(ifnames.size(),nullptr);
+    try {
+      for (size_t t; (t = next_task++) < tasks.size(); ) {
+        const scan_task& task = tasks[t];
+        scan_task_index = t;
+
+        TFile*& f = handles[task.file];
+        if (!f) {
+          timer t(timer::open);
+          worker_files[w].emplace_back(
+            std::make_unique<TFile>(ifnames[task.file]));
+          f = worker_files[w].back().get();
+          if (f->IsZombie()) throw ivanp::error(
+            "cannot open file ",ifnames[task.file]);
+        }
+        timer tk(timer::keys);
+        TDirectory* dir = task.path.empty()
+          ? f : f->GetDirectory(task.path.c_str());
+        if (!dir) throw ivanp::error(
+          "cannot read directory ",task.path," in ",ifnames[task.file]);
+
+        auto add = [&result = results[t]](shared_str&& group, hist&& h) {
+          result.emplace_back(std::move(group),std::move(h));
+        };
+        for (const auto& k : task.keys) {
+          TKey* key = dir->GetKey(k.first.c_str(),k.second);
+          if (!key) throw ivanp::error(
+            "cannot read key ",k.first,';',k.second," in ",ifnames[task.file]);
+          scan_key(*key,prog,add);
+        }
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(err_mx);
+      if (!err) err = std::current_exception();
+      next_task = tasks.size(); // stop other workers
+    }
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(njobs);
+  expression::threaded = njobs > 1;
+  for (unsigned w=0; w<njobs; ++w) workers.emplace_back(work,w);
+  for (auto& w : workers) w.join();
+  expression::threaded = false;
+  apply_globals();
+
+  for (auto& wf : worker_files)
+    for (auto& f : wf) files.emplace_back(std::move(f));
+
+  if (err) std::rethrow_exception(err);
+
+  return results;
+}
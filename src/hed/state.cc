@@ -0,0 +1,109 @@
+#include "hed/state.hh"
+
+#include <fstream>
+#include <cstdio>
+#include <cerrno>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "error.hh"
+
+namespace {
+
+void hash_axis(fnv1a& hash, const TAxis* a) {
+  hash(a->GetNbins())(a->GetXmin())(a->GetXmax())(a->GetTitle());
+  const TArrayD* edges = a->GetXbins();
+  if (edges->GetSize())
+    hash.add(edges->GetArray(),edges->GetSize()*sizeof(Double_t));
+}
+
+constexpr const char* state_name = "/state";
+constexpr const char* state_header = "hed state 2"; // format version
+
+} // end namespace
+
+void hash_hist(fnv1a& hash, const hist& h) {
+  hash(h->ClassName())(h->GetName())(h->GetTitle())(h->GetOption());
+  hash(h.legend ? h.legend->c_str() : nullptr);
+
+  const int dim = h->GetDimension();
+  hash(dim);
+  hash_axis(hash,h->GetXaxis());
+  if (dim > 1) hash_axis(hash,h->GetYaxis());
+  if (dim > 2) hash_axis(hash,h->GetZaxis());
+
+  for (int i=0, n=h->GetNcells(); i<n; ++i) hash(h->GetBinContent(i));
+  const TArrayD* sumw2 = h->GetSumw2();
+  if (sumw2->GetSize())
+    hash.add(sumw2->GetArray(),sumw2->GetSize()*sizeof(Double_t));
+
+  hash(h->GetEntries())(h->GetMinimumStored())(h->GetMaximumStored());
+  hash(h->GetLineColor())(h->GetLineStyle())(h->GetLineWidth());
+  hash(h->GetMarkerColor())(h->GetMarkerStyle())(h->GetMarkerSize());
+  hash(h->GetFillColor())(h->GetFillStyle());
+  hash(h->GetStats());
+}
+
+page_cache::page_cache(const std::string& ofname): _dir(ofname+".hed") {
+  if (mkdir(_dir.c_str(),0777) && errno!=EEXIST) throw ivanp::error(
+    "cannot create directory ",_dir);
+
+  std::ifstream state(_dir+state_name);
+  std::string header;
+  if (!std::getline(state,header) || header!=state_header) return;
+  unsigned long long hash;
+  bool drawn;
+  size_t len;
+  std::string title;
+  // titles are length-prefixed, because they may contain newlines
+  while (state >> std::hex >> hash >> drawn >> std::dec >> len) {
+    state.get(); // space before title
+    title.resize(len);
+    if (!state.read(&title[0],len)) break;
+    _old[hash] = { drawn, title };
+  }
+}
+
+std::string page_cache::file(uint64_t hash) const {
+  char name[24];
+  snprintf(name,sizeof(name),"/%016llx.pdf",(unsigned long long)hash);
+  return _dir + name;
+}
+
+auto page_cache::find(uint64_t hash) const -> const entry* {
+  const auto it = _old.find(hash);
+  if (it==_old.end()) return nullptr;
+  if (it->second.drawn && access(file(hash).c_str(),R_OK)) return nullptr;
+  return &it->second;
+}
+
+void page_cache::save() const {
+  const std::string name = _dir+state_name, tmp = name+".tmp";
+  {
+    std::ofstream state(tmp);
+    state << state_header << '\n';
+    char hash[24];
+    for (const auto& p : _new) {
+      snprintf(hash,sizeof(hash),"%016llx",(unsigned long long)p.first);
+      state << hash <<' '<< p.second.drawn <<' '
+            << p.second.title.size() <<' '<< p.second.title << '\n';
+    }
+    if (!state) throw ivanp::error("cannot write ",tmp);
+  }
+  if (std::rename(tmp.c_str(),name.c_str())) throw ivanp::error(
+    "cannot write ",name);
+
+  // remove pages of groups that changed or no longer exist
+  if (DIR* dir = opendir(_dir.c_str())) {
+    while (const dirent* f = readdir(dir)) {
+      unsigned long long hash;
+      char ext[8];
+      if (sscanf(f->d_name,"%16llx.%7s",&hash,ext)!=2
+          || strcmp(ext,"pdf") || _new.count(hash)) continue;
+      std::remove((_dir+'/'+f->d_name).c_str());
+    }
+    closedir(dir);
+  }
+}
@@ -0,0 +1,141 @@
+#include "hed/summary.hh"
+
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+
+#include <TH1.h>
+#include <TAxis.h>
+#include <TArrayD.h>
+#include <TArrayF.h>
+#include <TProfile.h>
+#include <TProfile2D.h>
+#include <TProfile3D.h>
+
+namespace {
+
+// Keyed by address. Every place that deletes a histogram calls
+// forget_summary() first, so a reused address never finds a stale entry.
+std::unordered_map<const TH1*,hist_summary> summaries;
+std::mutex summaries_mx;
+
+// Bin widths, zero outside of the axis range, for integral_width
+std::vector<double> range_widths(const TAxis* a) {
+  std::vector<double> w(a->GetNbins()+2);
+  for (int i=a->GetFirst(), n=a->GetLast(); i<=n; ++i) w[i] = a->GetBinWidth(i);
+  return w;
+}
+
+// Accumulate one row of n bins along x, starting at index 1.
+// Written without branches, so that the loop vectorizes.
+template <bool Sumw2, typename T>
+void row(
+  hist_summary& s, const T* a, const double* e2, const double* wx,
+  double w, int x1, int x2, int n
+) noexcept {
+  constexpr double inf = std::numeric_limits<double>::infinity();
+  double integral = 0, integral_width = 0;
+  double min = s.min, max = s.max, min_err = s.min_err, max_err = s.max_err,
+         min_pos = s.min_pos;
+  int nonzero = 0;
+#pragma omp simd reduction(+:integral,integral_width) \
+  reduction(min:min,min_err,min_pos) reduction(max:max,max_err) \
+  reduction(|:nonzero)
+  for (int i=1; i<=n; ++i) {
+    const double y = a[i], e = std::sqrt(Sumw2 ? e2[i] : std::abs(y));
+    const bool full = (y!=0) | (e!=0), in = (i>=x1) & (i<=x2);
+    integral += in ? y : 0.;
+    integral_width += y*wx[i];
+    min = std::min(min, full ? y : inf);
+    max = std::max(max, full ? y : -inf);
+    min_err = std::min(min_err, full ? y-e : inf);
+    max_err = std::max(max_err, full ? y+e : -inf);
+    min_pos = std::min(min_pos, y>0 ? y : inf);
+    nonzero |= (y!=0);
+  }
+  s.integral += w ? integral : 0.;
+  s.integral_width += integral_width*w;
+  s.min = min; s.max = max; s.min_err = min_err; s.max_err = max_err;
+  s.min_pos = min_pos;
+  s.nonzero |= bool(nonzero);
+}
+
+template <typename T>
+void all_rows(
+  hist_summary& s, const TH1* h, const T* a, const double* e2
+) {
+  const int dim = h->GetDimension();
+  const TAxis *ax = h->GetXaxis(), *ay = h->GetYaxis(), *az = h->GetZaxis();
+  const int nx = ax->GetNbins(),
+            ny = dim > 1 ? ay->GetNbins() : 0,
+            nz = dim > 2 ? az->GetNbins() : 0;
+  const auto wx = range_widths(ax);
+  const auto wy = dim > 1 ? range_widths(ay) : std::vector<double>{1.};
+  const auto wz = dim > 2 ? range_widths(az) : std::vector<double>{1.};
+
+  // rows of regular bins; only row 0 in absent dimensions
+  for (int k=(nz?1:0), kn=(nz?nz:0); k<=kn; ++k) {
+    for (int j=(ny?1:0), jn=(ny?ny:0); j<=jn; ++j) {
+      const int offset = (nx+2)*(j + (ny+2)*k);
+      (e2 ? row<true,T> : row<false,T>)(
+        s, a+offset, e2 ? e2+offset : nullptr, wx.data(), wy[j]*wz[k],
+        ax->GetFirst(), ax->GetLast(), nx);
+    }
+  }
+}
+
+} // end namespace
+
+hist_summary::hist_summary(const TH1* h)
+: integral(0), integral_width(0),
+  min(std::numeric_limits<double>::max()),
+  max(std::numeric_limits<double>::lowest()),
+  min_err(min), max_err(max), min_pos(min), nonzero(false)
+{
+  const double* e2 = h->GetSumw2N() ? h->GetSumw2()->GetArray() : nullptr;
+  if (is_profile(h)) { // arrays hold sums, use bin means and their errors
+    const int n = h->GetNcells();
+    std::vector<double> bins(n), errs2(n);
+    for (int i=0; i<n; ++i) {
+      bins[i] = h->GetBinContent(i);
+      const double e = h->GetBinError(i);
+      errs2[i] = e*e;
+    }
+    all_rows(*this,h,bins.data(),errs2.data());
+  } else if (auto* arr = dynamic_cast<const TArrayD*>(h))
+    all_rows(*this,h,arr->GetArray(),e2);
+  else if (auto* arr = dynamic_cast<const TArrayF*>(h))
+    all_rows(*this,h,arr->GetArray(),e2);
+  else {
+    const int n = h->GetNcells();
+    std::vector<double> bins(n);
+    for (int i=0; i<n; ++i) bins[i] = h->GetBinContent(i);
+    all_rows(*this,h,bins.data(),e2);
+  }
+}
+
+bool is_profile(const TH1* h) {
+  return h->InheritsFrom(TProfile::Class())
+      || h->InheritsFrom(TProfile2D::Class())
+      || h->InheritsFrom(TProfile3D::Class());
+}
+
+hist_summary summary(const TH1* h) {
+  {
+    std::lock_guard<std::mutex> lock(summaries_mx);
+    const auto it = summaries.find(h);
+    if (it!=summaries.end()) return it->second;
+  }
+  const hist_summary s(h);
+  std::lock_guard<std::mutex> lock(summaries_mx);
+  summaries.emplace(h,s);
+  return s;
+}
+
+void forget_summary(const TH1* h) {
+  std::lock_guard<std::mutex> lock(summaries_mx);
+  summaries.erase(h);
+}
@@ -0,0 +1,24 @@
+#include "hed/timing.hh"
+
+#include <iomanip>
+
+bool timer::enabled = false;
+std::array<std::atomic<long long>,timer::nphases> timer::total { };
+thread_local timer* timer::current = nullptr;
+
+void timer::report(std::ostream& os) {
+  static constexpr const char* names[nphases] {
+    "open", "keys", "read", "exprs", "group", "range", "draw", "print"
+  };
+  long long sum = 0;
+  for (const auto& t : total) sum += t;
+  const auto flags = os.flags();
+  os << std::fixed << std::setprecision(3);
+  for (int i=0; i<nphases; ++i)
+    os << std::setw(8) << names[i] <<' '
+       << std::setw(10) << total[i]*1e-6 << " ms "
+       << std::setw(5) << std::setprecision(1)
+       << (sum ? 100.*total[i]/sum : 0.) << " %\n" << std::setprecision(3);
+  os << std::setw(8) << "total" <<' '<< std::setw(10) << sum*1e-6 << " ms\n";
+  os.flags(flags);
+}
@@ -0,0 +1,163 @@
+#include "hed/watch.hh"
+
+#include <iostream>
+#include <unordered_map>
+#include <functional>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include <TDirectory.h>
+
+#include "error.hh"
+#include "hed/scan.hh"
+#include "hed/timing.hh"
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+constexpr int quiet_ms = 1000; // wait for files to stop changing
+
+} // end namespace
+
+hist watcher::copy(const hist& h) {
+  hist c(static_cast<TH1*>(h->Clone()));
+  c->SetDirectory(nullptr);
+  c.key = h.key; // for d and f fields
+  c.legend = h.legend;
+  return c;
+}
+
+watcher::watcher(const std::vector<const char*>& names)
+: fd(inotify_init1(IN_CLOEXEC)) {
+  if (fd < 0) throw ivanp::error("inotify_init1() failed");
+  files.reserve(names.size());
+  for (const char* name : names) {
+    const char* slash = strrchr(name,'/');
+    const std::string dir = slash ? std::string(name,slash+1) : "./";
+    const int wd = inotify_add_watch(fd, dir.c_str(),
+      IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) throw ivanp::error("cannot watch directory ",dir);
+    files.push_back({name,nullptr,{},wd,slash ? slash+1 : name,true});
+  }
+}
+
+watcher::~watcher() {
+  close(fd);
+  for (auto& f : files)
+    for (auto& e : f.keys)
+      if (e.h.h) delete_hist(e.h.h);
+}
+
+void watcher::rescan(file& wf, const program& prog) {
+  std::unique_ptr<TFile> f;
+  { timer t(timer::open);
+    f = std::make_unique<TFile>(wf.name);
+  }
+  if (f->IsZombie()) {
+    std::cerr << "\033[31mcannot read " << wf.name
+              << ", keeping previous histograms\033[0m" << std::endl;
+    return;
+  }
+  cout << "\033[34mInput file:\033[0m " << f->GetName() << endl;
+
+  std::unordered_map<std::string,entry*> old;
+  old.reserve(wf.keys.size());
+  for (auto& e : wf.keys) old.emplace(e.id,&e);
+
+  std::vector<entry> keys;
+  keys.reserve(wf.keys.size());
+  std::vector<TH1*> read; // for plugins with run_batch
+  unsigned nread = 0;
+
+  // walk keys in the order of scan()
+  std::function<void(TDirectory*,const std::string&)> walk =
+  [&](TDirectory* dir, const std::string& path) {
+    timer t(timer::keys);
+    for (TKey& key : get_keys(dir)) {
+      const TClass* key_class = get_class(key);
+      const std::string id = path + key.GetName();
+
+      if (key_class->InheritsFrom(TH1::Class())) { // HIST
+        entry e { id + ';' + std::to_string(key.GetCycle()),
+                  key.GetSeekKey(), key.GetDatime().Get(),
+                  key.GetNbytes(), key.GetObjlen(), nullptr, hist(&key) };
+        const auto it = old.find(e.id);
+        if (it!=old.end() && it->second->seek==e.seek
+            && it->second->datime==e.datime
+            && it->second->nbytes==e.nbytes
+            && it->second->objlen==e.objlen) {
+          e.group = std::move(it->second->group);
+          e.h = std::move(it->second->h);
+          e.h.key = &key; // the old file is closed below
+        } else {
+          ++nread;
+          bool selected;
+          { timer t(timer::exprs);
+            selected = e.h(prog,e.group);
+          }
+          if (selected) {
+            e.h->SetDirectory(nullptr); // keep it after the file is closed
+            read.push_back(e.h.h);
+          } else e.group = nullptr, e.h.h = nullptr;
+        }
+        keys.push_back(std::move(e));
+
+      } else if (key_class->InheritsFrom(TDirectory::Class())) { // DIR
+        walk(read_dir(key), id + '/');
+      }
+    }
+  };
+  walk(f.get(),{});
+
+  for (auto& e : wf.keys) // histograms of keys that changed or are gone
+    if (e.h.h) delete_hist(e.h.h);
+  wf.keys = std::move(keys);
+  wf.f = std::move(f);
+
+  { timer t(timer::exprs);
+    run_batches(read);
+  }
+  cout << "read " << nread << " of " << wf.keys.size() << " keys" << endl;
+}
+
+void watcher::scan(const program& prog) {
+  for (auto& f : files) {
+    if (!f.changed) continue;
+    f.changed = false;
+    rescan(f,prog);
+  }
+}
+
+void watcher::wait() {
+  alignas(inotify_event) char buf[sizeof(inotify_event)+NAME_MAX+1];
+  bool changed = false;
+  for (;;) {
+    pollfd p { fd, POLLIN, 0 };
+    const int n = poll(&p,1,changed ? quiet_ms : -1);
+    if (n < 0) {
+      if (errno==EINTR) continue;
+      throw ivanp::error("poll() failed");
+    }
+    if (n == 0) return; // changed and quiet since
+
+    const ssize_t len = read(fd,buf,sizeof(buf));
+    if (len < 0) {
+      if (errno==EINTR) continue;
+      throw ivanp::error("cannot read inotify events");
+    }
+    for (const char* p = buf; p < buf+len; ) {
+      const auto* e = reinterpret_cast<const inotify_event*>(p);
+      p += sizeof(inotify_event) + e->len;
+      if (!e->len) continue;
+      for (auto& f : files)
+        if (f.wd==e->wd && f.base==e->name) f.changed = changed = true;
+    }
+  }
+}
@@ -0,0 +1,87 @@
+// Client for hed --daemon
+// Usage: hedc SOCKET [hed arguments]
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using std::cerr;
+using std::endl;
+
+bool write_all(int fd, const char* p, size_t n) {
+  while (n) {
+    const ssize_t m = write(fd,p,n);
+    if (m < 0) return false;
+    p += m; n -= m;
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    cerr << "usage: " << argv[0] << " SOCKET [hed arguments]" << endl;
+    return 1;
+  }
+
+  sockaddr_un addr { };
+  addr.sun_family = AF_UNIX;
+  if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+    cerr << "\033[31msocket path too long: " << argv[1] << "\033[0m" << endl;
+    return 1;
+  }
+  strcpy(addr.sun_path,argv[1]);
+
+  const int sock = socket(AF_UNIX,SOCK_STREAM,0);
+  if (sock < 0 || connect(sock,(sockaddr*)&addr,sizeof(addr))) {
+    cerr << "\033[31mcannot connect to " << argv[1] << ": "
+         << strerror(errno) << "\033[0m" << endl;
+    return 1;
+  }
+
+  // request: working directory and arguments, each terminated by '\0'
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd,sizeof(cwd))) {
+    cerr << "\033[31mgetcwd() failed\033[0m" << endl;
+    return 1;
+  }
+  std::string req(cwd,strlen(cwd)+1);
+  for (int i=2; i<argc; ++i) req.append(argv[i],strlen(argv[i])+1);
+  if (!write_all(sock,req.data(),req.size())) {
+    cerr << "\033[31mcannot send request\033[0m" << endl;
+    return 1;
+  }
+  shutdown(sock,SHUT_WR);
+
+  // response: output, then '\0', exit status, and output file name
+  std::string trailer;
+  bool out = true;
+  char buf[1<<12];
+  for (ssize_t n; (n = read(sock,buf,sizeof(buf))) > 0; ) {
+    if (out) {
+      const char* end = static_cast<const char*>(memchr(buf,'\0',n));
+      write_all(1,buf,end ? end-buf : n);
+      if (end) {
+        out = false;
+        trailer.append(end+1,buf+n-(end+1));
+      }
+    } else trailer.append(buf,n);
+  }
+  close(sock);
+
+  if (out) {
+    cerr << "\033[31mrequest terminated by the daemon\033[0m" << endl;
+    return 1;
+  }
+  const size_t space = trailer.find(' ');
+  const int status = atoi(trailer.c_str());
+  if (!status && space!=std::string::npos && space+1<trailer.size())
+    std::cout << trailer.substr(space+1) << std::endl;
+  return status;
+}
@@ -0,0 +1,71 @@
+// Generate a ROOT file with synthetic histograms for benchmarking hed
+
+#include <iostream>
+#include <random>
+#include <cmath>
+
+#include <TFile.h>
+#include <TH1.h>
+
+#include "program_options.hh"
+#include "string.hh"
+
+using std::cout;
+using std::endl;
+using namespace ivanp;
+
+unsigned nhists = 10, depth = 1, ndirs = 2, nbins = 100;
+std::mt19937 gen;
+
+// Gaussian shapes with noise, same names in every leaf directory
+void fill(TDirectory* dir, unsigned level) {
+  if (level) {
+    for (unsigned i=0; i<ndirs; ++i)
+      fill(dir->mkdir(cat('d',i).c_str()),level-1);
+    return;
+  }
+  std::normal_distribution<double> noise(1.,0.1);
+  std::uniform_real_distribution<double> norm(1e2,1e4);
+  for (unsigned i=0; i<nhists; ++i) {
+    TH1D h(cat('h',i).c_str(),cat("hist ",i).c_str(),nbins,-5,5);
+    const double n = norm(gen);
+    for (unsigned b=1; b<=nbins; ++b) {
+      const double x = h.GetXaxis()->GetBinCenter(b);
+      const double y = n*std::exp(-0.5*x*x)*noise(gen);
+      h.SetBinContent(b,y);
+      h.SetBinError(b,std::sqrt(std::abs(y)));
+    }
+    dir->WriteTObject(&h);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* ofname;
+  unsigned seed = 0;
+
+  try {
+    using namespace ivanp::po;
+    if (program_options()
+      (ofname,'o',"output file (.root)",req(),pos())
+      (nhists,'n',cat("histograms per directory [",nhists,']'))
+      (depth,'d',cat("directory depth [",depth,']'))
+      (ndirs,'w',cat("subdirectories per directory [",ndirs,']'))
+      (nbins,'b',cat("bins per histogram [",nbins,']'))
+      (seed,"--seed",cat("random seed [",seed,']'))
+      .parse(argc,argv,true)) return 0;
+  } catch (const std::exception& e) {
+    std::cerr <<"\033[31m"<< e.what() <<"\033[0m"<< endl;
+    return 1;
+  }
+
+  gen.seed(seed);
+  TH1::AddDirectory(false);
+
+  TFile f(ofname,"recreate");
+  if (f.IsZombie()) return 1;
+  fill(&f,depth);
+
+  unsigned n = nhists;
+  for (unsigned i=0; i<depth; ++i) n *= ndirs;
+  cout << ofname << ": " << n << " histograms" << endl;
+}
@@ -8,11 +8,15 @@
 #include <cstdio>
 #include <cstring>
 #include <map>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
 
 #include <TFile.h>
 #include <TTree.h>
 #include <TKey.h>
 #include <TBranch.h>
+#include <TBranchElement.h>
 #include <TLeaf.h>
 
 #include "program_options.hh"
@@ -50,23 +54,1040 @@ std::array<std::string,2> leaf_type(TLeaf* l) {
   return { type, {} };
 }
 
+// Selected branch of the input tree
+struct branch_def {
+  std::string in, out, var; // input and output branch names, variable name
+  std::array<std::string,2> type; // type and array dimensions
+  std::string out_type; // if different from the input type
+  bool multi_leaf;
+  unsigned bulk_n; // values per entry if can be bulk read, else 0
+  TBranch* b; // in the input tree
+  Int_t basket; // output basket size, 0 for the default
+  bool member; // of a split object
+};
+
+// Split object read whole
+bool split_object(const branch_def& b) {
+  return !b.member && !b.type[0].empty()
+      && b.b->GetListOfBranches()->GetEntries();
+}
+
+// Settings of the output file and tree
+struct out_settings {
+  const char* algorithm = nullptr; // compression, default if null
+  int level = 0;
+  Long64_t auto_flush = 0; // entries if positive, bytes if negative
+};
+
+// Output tree with the branches selected for it
+struct output_def {
+  std::string tree, cut;
+  out_settings settings;
+  std::vector<branch_def> defs;
+  std::vector<branch_def> cut_defs; // read only for the cut
+};
+
+// Size in bytes, with optional k, M or G suffix
+Long64_t parse_size(const std::string& str) {
+  char* end;
+  Long64_t size = strtoll(str.c_str(),&end,10);
+  switch (*end) {
+    case 'G': size <<= 10; [[fallthrough]];
+    case 'M': size <<= 10; [[fallthrough]];
+    case 'k': size <<= 10; ++end;
+  }
+  if (end==str.c_str() || *end || size<=0)
+    throw std::runtime_error(cat("invalid size \"",str,'\"'));
+  return size;
+}
+
+// Basket size that holds a cluster of entries of the input branch
+Int_t auto_basket(TBranch* b, Long64_t cluster) {
+  const Long64_t n = b->GetEntries();
+  if (!n || cluster<=0) return 0;
+  const double size = 1.1*b->GetTotBytes("*")/n*cluster;
+  return std::min(std::max(size,double(1<<12)),double(1<<24));
+}
+
+// Entries per output cluster, estimated from the input if set in bytes
+Long64_t cluster_entries(
+  const std::vector<branch_def>& defs, Long64_t auto_flush
+) {
+  if (auto_flush > 0) return auto_flush;
+  double zip = 0; // compressed bytes per entry
+  for (const auto& d : defs)
+    if (const Long64_t n = d.b->GetEntries())
+      zip += double(d.b->GetZipBytes("*"))/n;
+  // TTree flushes after 30 MB of compressed data by default
+  return zip>0 ? (auto_flush ? -auto_flush : 30000000)/zip : 0;
+}
+
+// Cache size to hold a cluster of the selected input branches
+Long64_t auto_cache(TTree* tree, const std::vector<branch_def>& defs) {
+  const Long64_t nent = tree->GetEntries();
+  Long64_t nclusters = 0;
+  auto it = tree->GetClusterIterator(0);
+  while (it() < nent) ++nclusters;
+  if (!nclusters) return 0;
+  double zip = 0;
+  for (const auto& d : defs) zip += d.b->GetZipBytes("*");
+  return std::min(std::max(1.2*zip/nclusters,double(1<<20)),double(1<<28));
+}
+
+// ROOT compression algorithm and its default level
+std::pair<const char*,int> compression(const std::string& name) {
+  if (name=="zlib") return {"kZLIB",1};
+  if (name=="lzma") return {"kLZMA",7};
+  if (name=="lz4" ) return {"kLZ4" ,4};
+  if (name=="zstd") return {"kZSTD",5};
+  throw std::runtime_error(cat("unknown compression algorithm \"",name,
+    "\", expected zlib, lzma, lz4 or zstd"));
+}
+
+// Number of values in a fixed size array, e.g. [2][3], or 0 if not fixed
+unsigned fixed_size(const std::string& dims) {
+  if (dims.empty()) return 1;
+  unsigned n = 1;
+  for (const char *p = dims.c_str(); *p; ) {
+    if (*p!='[' || !isdigit(*++p)) return 0;
+    n *= strtoul(p,const_cast<char**>(&p),10);
+    if (*p!=']') return 0;
+    ++p;
+  }
+  return n;
+}
+
+// Dimensions of the variable holding an input array,
+// with the maximum size seen when writing the first tree if variable,
+// as in TTree::MakeClass
+std::string declared_dims(const branch_def& b) {
+  if (b.multi_leaf || fixed_size(b.type[1])) return b.type[1];
+  const auto* l = static_cast<TLeaf*>(b.b->GetListOfLeaves()->First());
+  return cat('[',std::max(l->GetLeafCount()->GetMaximum(),1),']',
+    b.type[1].substr(b.type[1].find(']')+1));
+}
+
+// Fundamental ROOT leaf type, whose values can be checksummed bitwise
+bool basic_type(const std::string& type) {
+  static const std::unordered_set<std::string> types {
+    "Bool_t", "Char_t", "UChar_t", "Short_t", "UShort_t", "Int_t", "UInt_t",
+    "Long_t", "ULong_t", "Long64_t", "ULong64_t",
+    "Float_t", "Float16_t", "Double_t", "Double32_t",
+    "bool", "char", "short", "int", "long", "float", "double",
+    "unsigned char", "unsigned short", "unsigned int", "unsigned long"
+  };
+  return types.count(type);
+}
+
+// Generated helper for reading whole baskets of a branch with the bulk API
+const char* bulk_branch_code =
+  "// Branch read a basket at a time with the bulk API,\n"
+  "// or an entry at a time if its tree doesn't support it\n"
+  "template <typename T, unsigned N>\n"
+  "struct bulk_branch {\n"
+  "  const char* name;\n"
+  "  T* x;\n"
+  "  TBranch* b = nullptr;\n"
+  "  bool bulk = false;\n"
+  "  TBufferFile buf { TBuffer::kWrite, 1<<16 };\n"
+  "  Long64_t first = 0, last = 0; // entries in buf\n\n"
+  "  bulk_branch(const char* name, void* x)\n"
+  "  : name(name), x(static_cast<T*>(x)) { }\n\n"
+  "  void load(TTree* t) { // when the chain moves to the next tree\n"
+  "    b = t->GetBranch(name);\n"
+  "    if (!b) throw runtime_error(string(\"no branch \")+name);\n"
+  "    bulk = b->SupportsBulkRead();\n"
+  "    if (!bulk) b->SetAddress(x);\n"
+  "    first = last = 0;\n"
+  "  }\n"
+  "  void read(Long64_t ent) { // entry of the current tree\n"
+  "    if (!bulk) { b->GetEntry(ent,1); return; }\n"
+  "    if (ent < first || last <= ent) {\n"
+  "      const Long64_t* basket_entry = b->GetBasketEntry();\n"
+  "      first = basket_entry[TMath::BinarySearch(\n"
+  "        Long64_t(b->GetWriteBasket()+1), basket_entry, ent)];\n"
+  "      const Int_t n = b->GetBulkRead().GetBulkEntries(first,buf);\n"
+  "      if (n <= 0) throw runtime_error(string(\"cannot bulk read \")+name);\n"
+  "      last = first + n;\n"
+  "    }\n"
+  "    memcpy(x, reinterpret_cast<const T*>(buf.GetCurrent()) + (ent-first)*N,\n"
+  "      N*sizeof(T));\n"
+  "  }\n"
+  "};\n\n";
+
+// Generated helpers for entry ranges and for running shards in parallel
+const char* shards_code =
+  "// First entries of the clusters of all trees\n"
+  "vector<Long64_t> cluster_starts(TTree& tin) {\n"
+  "  vector<Long64_t> starts;\n"
+  "  const Long64_t nent = tin.GetEntries();\n"
+  "  for (Long64_t offset = 0; offset < nent; ) {\n"
+  "    tin.LoadTree(offset);\n"
+  "    TTree* t = tin.GetTree();\n"
+  "    const Long64_t n = t->GetEntries();\n"
+  "    auto it = t->GetClusterIterator(0);\n"
+  "    for (Long64_t e; (e = it()) < n; ) starts.push_back(offset+e);\n"
+  "    offset += n;\n"
+  "  }\n"
+  "  return starts;\n"
+  "}\n\n"
+  "// Run cluster aligned shards in nproc processes and merge their outputs.\n"
+  "// Outputs of finished shards are kept until they are merged,\n"
+  "// so that shards are skipped when the program is run again.\n"
+  "int drive(\n"
+  "  TTree& tin, int nproc, char** ofnames, int nout, char** in, int nin,\n"
+  "  const int* compress, bool threads\n"
+  ") {\n"
+  "  const auto starts = cluster_starts(tin);\n"
+  "  const Long64_t nent = tin.GetEntries();\n"
+  "  const size_t nc = starts.size();\n"
+  "  const size_t nshards = min(nc,size_t(nproc)*4);\n"
+  "  vector<pair<size_t,size_t>> ranges; // of clusters\n"
+  "  for (size_t k=1, c=0; c<nc; ++k) {\n"
+  "    size_t c2 = c+1;\n"
+  "    while (c2<nc && starts[c2] < Long64_t(nent*k/nshards)) ++c2;\n"
+  "    ranges.emplace_back(c,c2);\n"
+  "    c = c2;\n"
+  "  }\n"
+  "  auto name = [&](size_t i) {\n"
+  "    return to_string(ranges[i].first) + '-' + to_string(ranges[i].second);\n"
+  "  };\n"
+  "  auto shard = [&](size_t i, int k) {\n"
+  "    return string(ofnames[k]) + \".shard\" + name(i) + \".root\";\n"
+  "  };\n"
+  "  auto done = [&](size_t i) {\n"
+  "    for (int k=0; k<nout; ++k)\n"
+  "      if (access(shard(i,k).c_str(),F_OK)) return false;\n"
+  "    return true;\n"
+  "  };\n\n"
+  "  const string nthreads = to_string( // reading threads per shard\n"
+  "    max(1u,thread::hardware_concurrency()/unsigned(nproc)));\n"
+  "  map<pid_t,size_t> running;\n"
+  "  bool failed = false;\n"
+  "  for (size_t next = 0; next<ranges.size() || !running.empty(); ) {\n"
+  "    while (int(running.size()) < nproc && next<ranges.size()) {\n"
+  "      const size_t i = next++;\n"
+  "      if (done(i)) {\n"
+  "        cout << \"done: clusters \" << name(i) << endl;\n"
+  "        continue;\n"
+  "      }\n"
+  "      const string c1 = to_string(ranges[i].first),\n"
+  "                   c2 = to_string(ranges[i].second);\n"
+  "      vector<string> parts;\n"
+  "      for (int k=0; k<nout; ++k) parts.push_back(shard(i,k)+\".part\");\n"
+  "      vector<char*> args { (char*)\"shard\", (char*)\"-c\",\n"
+  "        (char*)c1.c_str(), (char*)c2.c_str() };\n"
+  "      if (threads) args.insert(args.begin()+1,\n"
+  "        { (char*)\"-t\", (char*)nthreads.c_str() });\n"
+  "      for (auto& part : parts) args.push_back((char*)part.c_str());\n"
+  "      args.insert(args.end(),in,in+nin);\n"
+  "      args.push_back(nullptr);\n"
+  "      cout.flush();\n"
+  "      const pid_t pid = fork();\n"
+  "      if (pid < 0) { cerr << \"fork() failed\" << endl; return 1; }\n"
+  "      if (pid == 0) {\n"
+  "        if (!freopen(\"/dev/null\",\"w\",stdout)) _exit(127);\n"
+  "        execv(\"/proc/self/exe\",args.data());\n"
+  "        _exit(127);\n"
+  "      }\n"
+  "      cout << \"running: clusters \" << name(i) << endl;\n"
+  "      running[pid] = i;\n"
+  "    }\n"
+  "    if (running.empty()) break;\n"
+  "    int status;\n"
+  "    const pid_t pid = wait(&status);\n"
+  "    if (pid < 0) { cerr << \"wait() failed\" << endl; return 1; }\n"
+  "    const size_t i = running[pid];\n"
+  "    running.erase(pid);\n"
+  "    bool ok = WIFEXITED(status) && !WEXITSTATUS(status);\n"
+  "    for (int k=0; k<nout && ok; ++k)\n"
+  "      ok = !rename((shard(i,k)+\".part\").c_str(),shard(i,k).c_str());\n"
+  "    if (ok) {\n"
+  "      cout << \"done: clusters \" << name(i) << endl;\n"
+  "    } else {\n"
+  "      cerr << \"failed: clusters \" << name(i) << endl;\n"
+  "      failed = true;\n"
+  "    }\n"
+  "  }\n"
+  "  if (failed) return 1;\n\n"
+  "  for (int k=0; k<nout; ++k) {\n"
+  "    TFileMerger merger(false);\n"
+  "    merger.SetFastMethod(true);\n"
+  "    if (!merger.OutputFile(ofnames[k],\"RECREATE\",compress[k])) return 1;\n"
+  "    for (size_t i=0; i<ranges.size(); ++i)\n"
+  "      if (!merger.AddFile(shard(i,k).c_str(),false)) return 1;\n"
+  "    if (!merger.Merge()) return 1;\n"
+  "  }\n"
+  "  for (size_t i=0; i<ranges.size(); ++i)\n"
+  "    for (int k=0; k<nout; ++k) remove(shard(i,k).c_str());\n"
+  "  return 0;\n"
+  "}\n\n";
+
+// Input tree and the arguments of the generated program.
+// With ranges, options for entry ranges and shards precede the file names,
+// and with threads, the number of reading threads.
+void write_input(
+  std::ostream& code, const std::string& tree_name, bool no_chain,
+  unsigned nout, bool ranges=false, bool threads=false
+) {
+  const std::string in = ranges
+    ? cat("argi+",nout) : std::to_string(nout+1);
+  std::string usage = ranges ? " [-e first last | -c first last | -j n]" : "";
+  if (threads) usage += " [-t n]";
+  if (nout==1) usage += " out.root";
+  else for (unsigned k=1; k<=nout; ++k) usage += cat(" out",k,".root");
+
+  if (ranges) code <<
+    "  // -e first last : entries [first,last)\n"
+    "  // -c first last : clusters [first,last)\n"
+    "  // -j n : run cluster aligned shards in n processes and merge them\n"
+    << (threads ? "  // -t n : threads for reading, all cores if 0\n" : "") <<
+    "  char range_type = 0;\n"
+    "  Long64_t range[2] { 0, 0 };\n"
+    "  int nproc = 0, " << (threads ? "nthreads = 0, " : "") << "argi = 1;\n"
+    "  while (argi<argc && argv[argi][0]=='-') {\n"
+    "    const char opt = argv[argi][1];\n"
+    "    if ((opt=='e' || opt=='c') && argi+2<argc) {\n"
+    "      range_type = opt;\n"
+    "      range[0] = atoll(argv[argi+1]);\n"
+    "      range[1] = atoll(argv[argi+2]);\n"
+    "      argi += 3;\n"
+    "    } else if (opt=='j' && argi+1<argc) {\n"
+    "      nproc = atoi(argv[argi+1]);\n"
+    "      argi += 2;\n"
+    << (threads ?
+    "    } else if (opt=='t' && argi+1<argc) {\n"
+    "      nthreads = atoi(argv[argi+1]);\n"
+    "      argi += 2;\n" : "") <<
+    "    } else break;\n"
+    "  }\n"
+    "  if (range_type && (range[0] < 0 || range[1] < range[0])) {\n"
+    "    cerr << \"invalid range -\" << range_type << ' '\n"
+    "         << range[0] << ' ' << range[1] << endl;\n"
+    "    return 1;\n"
+    "  }\n"
+    "  if (nproc < 0" << (threads ? " || nthreads < 0" : "") << ") {\n"
+    "    cerr << \"negative number of "
+    << (threads ? "processes or threads" : "processes") << "\" << endl;\n"
+    "    return 1;\n"
+    "  }\n"
+    "  if (range_type && nproc) {\n"
+    "    cerr << \"-j cannot be combined with -e or -c\" << endl;\n"
+    "    return 1;\n"
+    "  }\n";
+
+  // before the tree is created, because it takes the IMT setting then
+  if (threads) code <<
+    "  if (!nproc && nthreads!=1) // to unzip in parallel\n"
+    "    ROOT::EnableImplicitMT(nthreads);\n\n";
+
+  if (!no_chain) { code <<
+    "  if (argc" << (ranges ? "-argi<" : "<") << nout+(ranges ? 1 : 2) << ") {\n"
+    "    cout << \"usage: \" << argv[0] << \"" << usage
+    << " in.root ...\" << endl;\n"
+    "    return 1;\n  }\n\n"
+
+    "  TChain tin(\"" << tree_name << "\");\n"
+    "  cout << \"Input files:\" << endl;\n"
+    "  for (int i=" << in << "; i<argc; ++i) {\n"
+    "    cout <<\"  \"<< argv[i] << endl;\n"
+    "    if (!tin.Add(argv[i],0)) return 1;\n"
+    "  }\n\n";
+  } else { code <<
+    "  if (argc" << (ranges ? "-argi!=" : "!=") << nout+(ranges ? 1 : 2) << ") {\n"
+    "    cout << \"usage: \" << argv[0] << \"" << usage
+    << " in.root\" << endl;\n"
+    "    return 1;\n  }\n\n"
+
+    "  TFile fin(argv[" << in << "]);\n"
+    "  if (fin.IsZombie()) return 1;\n"
+    "  TTree& tin = *dynamic_cast<TTree*>("
+    "fin.Get(\"" << tree_name << "\"));\n\n";
+  }
+
+  if (ranges) code <<
+    "  char** ofnames = argv+argi;\n"
+    "  if (nproc > 0)\n"
+    "    return drive(tin,nproc,ofnames," << nout << ",\n"
+    "      argv+argi+" << nout << ",argc-argi-" << nout << ","
+    "compress," << (threads ? "true" : "false") << ");\n\n";
+}
+
+// Whether the expression refers to the variable
+bool uses(const std::string& expr, const std::string& var) {
+  return boost::regex_search(expr,
+    boost::regex(cat("(?<![\\w.])",var,"(?!\\w)")));
+}
+
+// C++ variable name for a branch name
+std::string var_name(std::string name) {
+  for (char& c : name)
+    if (!isalnum(c) && c!='_') c = '_';
+  return name;
+}
+
+// Input branches selected for any of the outputs, each once
+std::vector<const branch_def*> inputs(const std::vector<output_def>& outs) {
+  std::vector<const branch_def*> ins;
+  for (const auto& o : outs)
+    for (const auto* defs : { &o.defs, &o.cut_defs })
+      for (const auto& b : *defs)
+        if (std::none_of(ins.begin(),ins.end(),
+            [&](const branch_def* x){ return x->in==b.in; }))
+          ins.push_back(&b);
+  return ins;
+}
+
+// Branches bound to the variables of the cut,
+// the written ones it uses and then those read only for it
+std::vector<const branch_def*> cut_vars(const output_def& o) {
+  std::vector<const branch_def*> vars;
+  for (const auto& b : o.defs) if (uses(o.cut,b.var)) vars.push_back(&b);
+  for (const auto& b : o.cut_defs) vars.push_back(&b);
+  return vars;
+}
+
+// GetEntry / Fill loop
+// Every input branch is read once per entry for all of the outputs.
+// With cache, the selected branches are read ahead with a TTreeCache
+// of that size, and the next file of the chain is opened in the background.
+// With cuts, branches used by them are read first, and the others
+// only for entries that pass the cut of an output that needs them.
+void write_serial(
+  std::ostream& code, const std::vector<output_def>& outs,
+  const std::string& tree_name, bool no_chain, bool bulk, Long64_t cache
+) {
+  const auto ins = inputs(outs);
+  const size_t nin = ins.size(), nout = outs.size();
+  auto index = [&](const branch_def& b) -> size_t {
+    for (size_t i=0; i<nin; ++i) if (ins[i]->in==b.in) return i;
+    return nin;
+  };
+  auto sfx = [&](size_t k){ return nout>1 ? std::to_string(k) : ""; };
+
+  if (bulk) bulk = std::any_of(ins.begin(),ins.end(),
+    [](const branch_def* b){ return b->bulk_n; });
+  const bool prefetch = cache && !no_chain;
+  const bool cuts = std::any_of(outs.begin(),outs.end(),
+    [](const output_def& o){ return !o.cut.empty(); });
+  const bool all_cut = std::all_of(outs.begin(),outs.end(),
+    [](const output_def& o){ return !o.cut.empty(); });
+  // read each branch by itself instead of the whole entry
+  const bool by_branch = cuts || bulk;
+
+  std::vector<bool> in_cut(nin); // read before the cuts
+  std::vector<std::vector<size_t>> needed_by(nin); // outputs
+  for (size_t k=0; k<nout; ++k)
+    for (const auto& b : outs[k].defs) {
+      const size_t i = index(b);
+      needed_by[i].push_back(k);
+      if (uses(outs[k].cut,b.var)) in_cut[i] = true;
+    }
+  for (const auto& o : outs)
+    for (const auto& b : o.cut_defs) in_cut[index(b)] = true;
+
+  code <<
+    "#include <iostream>\n"
+    "#include <iomanip>\n"
+    "#include <vector>\n";
+  if (bulk) code <<
+    "#include <cstring>\n"
+    "#include <stdexcept>\n";
+  code <<
+    "#include <string>\n"
+    "#include <map>\n"
+    "#include <algorithm>\n"
+    "#include <thread>\n"
+    "#include <cstdio>\n"
+    "#include <cstdlib>\n\n"
+    "#include <unistd.h>\n"
+    "#include <sys/wait.h>\n\n"
+    "#include <TFile.h>\n"
+    "#include <" << (no_chain ? "TTree" : "TChain") << ".h>\n"
+    "#include <TFileMerger.h>\n"
+    "#include <Compression.h>\n";
+  if (cache) code <<
+    "#include <TROOT.h>\n";
+  if (by_branch) code <<
+    "#include <TBranch.h>\n";
+  if (bulk) code <<
+    "#include <TBufferFile.h>\n"
+    "#include <TMath.h>\n";
+  code << "\n"
+    "using namespace std;\n\n";
+  if (bulk) code << bulk_branch_code;
+  code << shards_code <<
+    "int main(int argc, char* argv[]) {\n";
+
+  code << "  const int compress[] {";
+  for (const auto& o : outs) {
+    code << (&o!=&outs.front() ? "," : "") << "\n    ";
+    if (o.settings.algorithm) code << "ROOT::CompressionSettings("
+      "ROOT::RCompressionSetting::EAlgorithm::" << o.settings.algorithm
+      << ',' << o.settings.level << ')';
+    else code << "ROOT::RCompressionSetting::EDefaults::kUseCompiledDefault";
+  }
+  code << "\n  };\n\n";
+
+  write_input(code,tree_name,no_chain,nout,true,cache);
+
+  for (size_t k=0; k<nout; ++k) {
+    const auto& o = outs[k];
+    code <<
+    "  TFile fout" << sfx(k) << "(ofnames[" << k << "],\"recreate\",\"\","
+    "compress[" << k << "]);\n"
+    "  if (fout" << sfx(k) << ".IsZombie()) return 1;\n"
+    "  TTree tout" << sfx(k) << "(\"" << o.tree << "\",\"\");\n";
+    if (o.settings.auto_flush)
+      code << "  tout" << sfx(k) << ".SetAutoFlush("
+           << o.settings.auto_flush << ");\n";
+  }
+  code << "\n";
+  if (std::any_of(ins.begin(),ins.end(),
+      [](const branch_def* b){ return b->member; })) code <<
+    "  tin.SetMakeClass(1); // read members of split objects separately\n";
+  code <<
+    "  tin.SetBranchStatus(\"*\",0);\n"
+    "  auto in = [&](const char* name, auto* x"
+    << (by_branch ? ", TBranch** b" : "") << "){\n"
+    "    tin.SetBranchStatus(name,1);\n"
+    "    tin.SetBranchAddress(name,x" << (by_branch ? ",b" : "") << ");\n"
+    "  };\n"
+    << endl;
+
+  std::vector<std::string> in_vars;
+  for (const auto* b : ins) {
+    const auto var = var_name(b->in);
+    in_vars.push_back(var);
+    code << "  " << b->type[0] << ' ' << var << declared_dims(*b) << ";\n";
+    if (bulk && b->bulk_n)
+      code << "  bulk_branch<" << b->type[0] << ',' << b->bulk_n << "> "
+           << var << "__bulk(\"" << b->in << "\",&" << var << ");\n"
+              "  tin.SetBranchStatus(\"" << b->in << "\",1); // for the cache\n";
+    else if (by_branch)
+      code << "  TBranch* " << var << "__b = nullptr;\n"
+              "  in(\"" << b->in << "\",&" << var << ",&" << var << "__b);\n";
+    else
+      code << "  in(\"" << b->in << "\",&" << var << ");\n";
+  }
+  code << '\n';
+
+  // output branches, converted if the type is different
+  for (size_t k=0; k<nout; ++k)
+    for (const auto& b : outs[k].defs) {
+      const auto& var = in_vars[index(b)];
+      const bool change_type = !b.out_type.empty();
+      if (change_type)
+        code << "  " << b.out_type << ' ' << b.var << "__out" << sfx(k)
+             << b.type[1] << ";\n";
+      code << "  tout" << sfx(k) << ".Branch(\"" << b.out << "\",&";
+      if (change_type) code << b.var << "__out" << sfx(k);
+      else code << var;
+      if (b.basket) code << ',' << b.basket;
+      code << ");\n";
+    }
+
+  // cuts of the outputs, with their variables named as the output branches
+  std::vector<std::string> args(nout);
+  for (size_t k=0; k<nout; ++k) {
+    const auto& o = outs[k];
+    if (o.cut.empty()) continue;
+    code << "  auto select" << sfx(k) << " = [](";
+    for (const auto* b : cut_vars(o)) {
+      const auto& var = in_vars[index(*b)];
+      if (!args[k].empty()) code << ", ", args[k] += ',';
+      code << "const ";
+      if (b->multi_leaf) code << "decltype(" << var << ")& " << b->var;
+      else if (!b->type[1].empty() && fixed_size(b->type[1]))
+        code << b->type[0] << " (&" << b->var << ')' << b->type[1];
+      else if (!b->type[1].empty()) {
+        // variable size array, by pointer to its first element
+        const auto rest = b->type[1].substr(b->type[1].find(']')+1);
+        if (rest.empty()) code << b->type[0] << "* " << b->var;
+        else code << b->type[0] << " (*" << b->var << ')' << rest;
+      } else
+        code << (b->out_type.empty() ? b->type[0] : b->out_type)
+             << "& " << b->var;
+      args[k] += var;
+    }
+    code << "){\n"
+      "    return " << o.cut << ";\n"
+      "  };\n";
+  }
+
+  code << "\n"
+    "  unsigned percent = 0;\n"
+    "  const Long64_t nent = tin.GetEntries();\n"
+    "  Long64_t first = 0, last = nent;\n"
+    "  if (range_type=='e') {\n"
+    "    first = min(range[0],nent);\n"
+    "    last  = min(range[1],nent);\n"
+    "  } else if (range_type=='c') {\n"
+    "    const auto starts = cluster_starts(tin);\n"
+    "    auto at = [&](Long64_t c){\n"
+    "      return c < Long64_t(starts.size()) ? starts[c] : nent;\n"
+    "    };\n"
+    "    first = at(range[0]);\n"
+    "    last  = at(range[1]);\n"
+    "  }\n";
+
+  if (cache) {
+    code << "\n"
+    "  tin.LoadTree(first); // the cache is attached to the current file\n"
+    "  tin.SetCacheSize(" << cache << ");\n"
+    "  tin.SetCacheEntryRange(first,last);\n";
+    for (const auto* b : ins)
+      code << "  tin.AddBranchToCache(\"" << b->in << "\",true);\n";
+    code <<
+    "  tin.StopCacheLearningPhase();\n";
+  }
+  if (prefetch) code <<
+    "  auto prefetch = [&](int i){ // open the file in the background\n"
+    "    const auto* files = tin.GetListOfFiles();\n"
+    "    if (i < files->GetEntries())\n"
+    "      TFile::AsyncOpen(files->At(i)->GetTitle());\n"
+    "  };\n";
+
+  code << "\n"
+    "  cout << \"  0%\\b\\b\\b\\b\" << flush;\n"
+    << (bulk || prefetch ? "  int tree = -1;\n" : "") <<
+    "  for (Long64_t ent=first; ent<last; ++ent) {\n"
+    "    if (percent < (100.*(ent-first)/(last-first)))\n"
+    "      cout << setw(3) << ++percent << \"%\\b\\b\\b\\b\" << flush;\n";
+  if (by_branch)
+    code << "    const auto local = tin.LoadTree(ent);\n";
+  else if (prefetch)
+    code << "    tin.LoadTree(ent);\n";
+  if (bulk || prefetch) {
+    code <<
+    "    if (tree != tin.GetTreeNumber()) {\n"
+    "      tree = tin.GetTreeNumber();\n";
+    for (size_t i=0; i<nin; ++i) if (bulk && ins[i]->bulk_n)
+      code << "      " << in_vars[i] << "__bulk.load(tin.GetTree());\n";
+    if (prefetch) code <<
+    "      tin.StopCacheLearningPhase();\n"
+    "      prefetch(tree+1);\n";
+    code <<
+    "    }\n";
+  }
+
+  auto read = [&](size_t i, const char* indent) {
+    code << indent << in_vars[i];
+    if (bulk && ins[i]->bulk_n) code << "__bulk.read(local);\n";
+    else code << "__b->GetEntry(local);\n";
+  };
+  // condition that one of the outputs passed its cut
+  auto passed = [&](const std::vector<size_t>& ks) {
+    std::string cond;
+    for (size_t k : ks)
+      cond += cat(cond.empty() ? "" : " || ","pass",sfx(k));
+    return cond;
+  };
+
+  if (cuts) {
+    for (size_t i=0; i<nin; ++i) if (in_cut[i]) read(i,"    ");
+    code << '\n';
+    for (size_t k=0; k<nout; ++k) if (!outs[k].cut.empty())
+      code << "    const bool pass" << sfx(k) << " = select" << sfx(k)
+           << '(' << args[k] << ");\n";
+    if (all_cut) {
+      std::vector<size_t> all(nout);
+      for (size_t k=0; k<nout; ++k) all[k] = k;
+      code << "    if (!(" << passed(all) << ")) continue;\n";
+    }
+    code << '\n';
+    for (size_t i=0; i<nin; ++i) {
+      if (in_cut[i]) continue;
+      const auto& ks = needed_by[i];
+      // read unconditionally if needed by an output without a cut,
+      // or by all outputs when entries that pass none are skipped
+      if ((all_cut && ks.size()==nout) || std::any_of(ks.begin(),ks.end(),
+            [&](size_t k){ return outs[k].cut.empty(); }))
+        read(i,"    ");
+      else {
+        code << "    if (" << passed(ks) << ")\n";
+        read(i,"      ");
+      }
+    }
+  } else if (bulk) {
+    for (size_t i=0; i<nin; ++i) read(i,"    ");
+  } else {
+    code << "    tin.GetEntry(ent);\n";
+  }
+
+  for (size_t k=0; k<nout; ++k) {
+    // the only output with a cut is filled only for entries that pass it
+    const bool guard = !outs[k].cut.empty() && nout>1;
+    const char* indent = guard ? "      " : "    ";
+    code << '\n';
+    if (guard) code << "    if (pass" << sfx(k) << ") {\n";
+    for (const auto& b : outs[k].defs)
+      if (!b.out_type.empty())
+        code << indent << b.var << "__out" << sfx(k) << " = "
+             << in_vars[index(b)] << ";\n";
+    code << indent << "tout" << sfx(k) << ".Fill();\n";
+    if (guard) code << "    }\n";
+  }
+
+  code <<
+    "  }\n"
+    "  cout << \"100%\" << endl;\n";
+  for (size_t k=0; k<nout; ++k) if (!outs[k].cut.empty()) {
+    code << "  cout << ";
+    if (nout>1) code << "ofnames[" << k << "] << \": selected \"";
+    else code << "\"Selected \"";
+    code << " << tout" << sfx(k) << ".GetEntries() << \" of \" << last-first\n"
+      "       << \" entries\" << endl;\n";
+  }
+  if (cache) code <<
+    "  tin.PrintCacheStats();\n"
+    "  cout << \"Read \" << TFile::GetFileBytesRead() << \" bytes in \"\n"
+    "       << TFile::GetFileReadCalls() << \" calls\" << endl;\n";
+  for (size_t k=0; k<nout; ++k)
+    code << "  fout" << sfx(k) << ".Write(0,TObject::kOverwrite);\n";
+  code << "}" << endl;
+}
+
+// Implicit multithreading with RDataFrame::Snapshot
+void write_mt(
+  std::ostream& code, const std::vector<output_def>& outs,
+  const std::string& tree_name, bool no_chain
+) {
+  const size_t nout = outs.size();
+  auto sfx = [&](size_t k){ return nout>1 ? std::to_string(k) : ""; };
+
+  for (const auto& o : outs)
+    for (const auto* defs : { &o.defs, &o.cut_defs })
+      for (const auto& b : *defs) {
+        if (b.multi_leaf) throw std::runtime_error(cat(
+          "branch ",b.in," has multiple leaves, which RDataFrame reads "
+          "as separate columns; select its leaves in the serial mode"));
+        if (b.basket) throw std::runtime_error(
+          "RDataFrame doesn't set basket sizes of individual branches");
+      }
+
+  code <<
+    "#include <iostream>\n"
+    "#include <vector>\n"
+    "#include <string>\n"
+    "#include <cstring>\n\n"
+    "#include <TFile.h>\n"
+    "#include <" << (no_chain ? "TTree" : "TChain") << ".h>\n"
+    "#include <ROOT/RDataFrame.hxx>\n\n"
+    "using namespace std;\n"
+    "using ROOT::VecOps::RVec;\n\n"
+    // order-independent checksum: sum of hashes of entries
+    "ULong64_t hash_value(ULong64_t x) { // splitmix64 finalizer\n"
+    "  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;\n"
+    "  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;\n"
+    "  return x ^ (x >> 31);\n"
+    "}\n"
+    "template <typename T>\n"
+    "ULong64_t hash_bits(const T& x) {\n"
+    "  ULong64_t b = 0;\n"
+    "  memcpy(&b,&x,sizeof(x));\n"
+    "  return hash_value(b);\n"
+    "}\n"
+    "template <typename T>\n"
+    "ULong64_t hash_bits(const RVec<T>& x) {\n"
+    "  ULong64_t b = x.size();\n"
+    "  for (const auto& xi : x) b = hash_value(b ^ hash_bits(xi));\n"
+    "  return b;\n"
+    "}\n"
+    // written independently of the Define conversions
+    "// conversion as by assignment in the serial loop\n"
+    "template <typename Out, typename In>\n"
+    "void assign(Out& y, const In& x) { y = x; }\n"
+    "template <typename Out, typename In>\n"
+    "void assign(RVec<Out>& y, const RVec<In>& x) {\n"
+    "  y.resize(x.size());\n"
+    "  for (size_t i=0; i<x.size(); ++i) y[i] = x[i];\n"
+    "}\n"
+    "// checksum of column col of type In, converted to Out\n"
+    "template <typename Out, typename In = Out, typename DF>\n"
+    "ROOT::RDF::RResultPtr<ULong64_t> checksum(DF& df, const char* col) {\n"
+    "  return df.Aggregate(\n"
+    "    [](ULong64_t& sum, const In& x){\n"
+    "      Out y;\n"
+    "      assign(y,x);\n"
+    "      sum += hash_bits(y);\n"
+    "    },\n"
+    "    [](ULong64_t a, ULong64_t b){ return a+b; }, col, ULong64_t(0));\n"
+    "}\n\n"
+    "int main(int argc, char* argv[]) {\n";
+
+  write_input(code,tree_name,no_chain,nout);
+
+  code <<
+    "  ROOT::EnableImplicitMT();\n"
+    "  ROOT::RDataFrame df(tin);\n";
+
+  for (size_t k=0; k<nout; ++k) {
+    const auto& o = outs[k];
+    code << "\n"
+      "  auto out" << sfx(k) << " = df";
+    for (const auto& b : o.defs) {
+      if (!b.out_type.empty()) {
+        code << "\n    ." << (b.out==b.in ? "Redefine" : "Define")
+             << "(\"" << b.out << "\",";
+        // same conversion as assignment of the input to the output variable
+        if (b.type[1].empty())
+          code << "[](const " << b.type[0] << "& x) -> " << b.out_type
+               << " { return x; },";
+        else
+          code << "[](const RVec<" << b.type[0] << ">& x) { return RVec<"
+               << b.out_type << ">(x.begin(),x.end()); },";
+        code << "{\"" << b.in << "\"})";
+      } else if (b.out!=b.in) {
+        code << "\n    .Alias(\"" << b.out << "\",\"" << b.in << "\")";
+      }
+    }
+    if (!o.cut.empty()) {
+      // same variables as in the serial loop,
+      // columns read only for the cut are named as the input branches
+      const auto vars = cut_vars(o);
+      code << "\n    .Filter([](";
+      for (const auto* b : vars) {
+        const auto& type = b->out_type.empty() ? b->type[0] : b->out_type;
+        code << (b!=vars.front() ? ", " : "") << "const "
+             << (b->type[1].empty() ? type : "RVec<"+type+">")
+             << "& " << b->var;
+      }
+      code << "){ return " << o.cut << "; },{";
+      for (const auto* b : vars)
+        code << (b!=vars.front() ? "," : "") << '\"' << b->out << '\"';
+      code << "})";
+    }
+    code << ";\n"
+      "  const vector<string> columns" << sfx(k) << " {";
+    for (const auto& b : o.defs)
+      code << "\n    \"" << b.out << "\"" << (&b!=&o.defs.back() ? "," : "");
+    code << "\n  };\n";
+  }
+
+  // Checksums of columns of fundamental types.
+  // Expected values are computed from the input columns, selected by
+  // the cut and converted as in the serial loop, independently of the
+  // nodes that Snapshot writes, in the same event loop.
+  // They are compared with checksums of the written trees.
+  auto array = [](const branch_def& b, const std::string& type) {
+    return b.type[1].empty() ? type : "RVec<"+type+">";
+  };
+  std::vector<std::vector<const branch_def*>> checked(nout);
+  for (size_t k=0; k<nout; ++k)
+    for (const auto& b : outs[k].defs)
+      if (basic_type(b.out_type.empty() ? b.type[0] : b.out_type))
+        checked[k].push_back(&b);
+  auto sums = [&](
+    const std::string& name, const std::string& df, size_t k,
+    bool input, const char* indent
+  ) {
+    code << indent << "vector<ROOT::RDF::RResultPtr<ULong64_t>> "
+         << name << " {";
+    for (const auto* b : checked[k]) {
+      code << (b!=checked[k].front() ? "," : "") << '\n' << indent
+           << "  checksum<"
+           << array(*b, b->out_type.empty() ? b->type[0] : b->out_type);
+      if (input) code << ',' << array(*b,b->type[0]);
+      code << ">(" << df << ",\"" << (input ? b->in : b->out) << "\")";
+    }
+    code << '\n' << indent << "};\n";
+  };
+  for (size_t k=0; k<nout; ++k) {
+    const auto& o = outs[k];
+    code << "\n"
+      "  auto expected" << sfx(k) << " = df";
+    if (!o.cut.empty()) {
+      // input columns bound to the cut's variables as in the serial loop
+      const auto vars = cut_vars(o);
+      code << ".Filter([](";
+      for (const auto* b : vars)
+        code << (b!=vars.front() ? ", " : "") << "const "
+             << array(*b,b->type[0]) << "& " << b->var << "__in";
+      code << "){\n";
+      for (const auto* b : vars) {
+        const auto& type = b->out_type.empty() || !b->type[1].empty()
+          ? b->type[0] : b->out_type;
+        code << "      const " << array(*b,type) << "& " << b->var
+             << " = " << b->var << "__in;\n";
+      }
+      code << "      return " << o.cut << ";\n"
+        "    },{";
+      for (const auto* b : vars)
+        code << (b!=vars.front() ? "," : "") << '\"' << b->in << '\"';
+      code << "})";
+    }
+    code << ";\n";
+    sums("sums"+sfx(k),"expected"+sfx(k),k,true,"  ");
+  }
+
+  code << "\n"
+    "  const auto nent = tin.GetEntries();\n"
+    "  cout << \"Entries: \" << nent << \" on \""
+    " << ROOT::GetThreadPoolSize() << \" threads\" << endl;\n";
+  for (size_t k=0; k<nout; ++k) {
+    const auto& o = outs[k];
+    const auto opts = "opts"+sfx(k);
+    code << "\n"
+      "  ROOT::RDF::RSnapshotOptions " << opts << ";\n";
+    if (nout>1) code << "  " << opts << ".fLazy = true;\n";
+    if (o.settings.algorithm) code <<
+      "  " << opts << ".fCompressionAlgorithm =\n"
+      "    ROOT::RCompressionSetting::EAlgorithm::" << o.settings.algorithm
+      << ";\n"
+      "  " << opts << ".fCompressionLevel = " << o.settings.level << ";\n";
+    if (o.settings.auto_flush)
+      code << "  " << opts << ".fAutoFlush = " << o.settings.auto_flush
+           << ";\n";
+    if (!o.cut.empty()) code <<
+      "  auto selected" << sfx(k) << " = expected" << sfx(k)
+      << ".Count();\n";
+    code << "  ";
+    if (nout>1) code << "auto snapshot" << k << " = ";
+    code << "out" << sfx(k) << ".Snapshot(\"" << o.tree << "\",argv["
+         << k+1 << "],columns" << sfx(k) << ',' << opts << ");\n";
+  }
+  if (nout>1) code << "\n"
+    "  snapshot0.GetValue(); // run the event loop for all of them\n";
+
+  code << "\n"
+    // compare with what the serial loop would have written
+    "  auto check = [](\n"
+    "    const char* fname, Long64_t nout, Long64_t nsel,\n"
+    "    const vector<string>& columns,\n"
+    "    vector<ROOT::RDF::RResultPtr<ULong64_t>>& expected,\n"
+    "    vector<ROOT::RDF::RResultPtr<ULong64_t>>& written\n"
+    "  ){\n"
+    "    cout << fname << \": written \" << nout << \" of \" << nsel"
+    " << \" entries\";\n"
+    "    if (nout!=nsel) {\n"
+    "      cout << \", fewer than the serial loop would write\" << endl;\n"
+    "      return false;\n"
+    "    }\n"
+    "    cout << \", in a different order than the serial loop\"\n"
+    "            \" if there was more than one task\" << endl;\n"
+    "    bool ok = true;\n"
+    "    for (size_t i=0; i<columns.size(); ++i)\n"
+    "      if (*expected[i]!=*written[i]) {\n"
+    "        cerr << fname << \": column \" << columns[i]\n"
+    "             << \" differs from the selected input converted\"\n"
+    "                \" as in the serial loop\" << endl;\n"
+    "        ok = false;\n"
+    "      }\n"
+    "    return ok;\n"
+    "  };\n"
+    "  bool ok = true;\n";
+  for (size_t k=0; k<nout; ++k) {
+    const auto w = "written"+sfx(k);
+    code << "  {\n"
+      "    ROOT::RDataFrame " << w << "(\"" << outs[k].tree << "\",argv["
+      << k+1 << "]);\n"
+      "    auto n = " << w << ".Count();\n"
+      "    const vector<string> columns {";
+    for (const auto* b : checked[k])
+      code << (b!=checked[k].front() ? "," : "") << '\"' << b->out << '\"';
+    code << "};\n";
+    sums("written_sums",w,k,false,"    ");
+    code <<
+      "    ok &= check(argv[" << k+1 << "],*n,"
+      << (outs[k].cut.empty() ? "nent" : "*selected"+sfx(k))
+      << ",columns,sums" << sfx(k) << ",written_sums);\n"
+      "  }\n";
+  }
+  code <<
+    "  return ok ? 0 : 1;\n"
+    "}" << endl;
+}
+
+// Options that can be different for every output
+struct output_opts {
+  std::vector<std::pair<sed_opt,std::string>> branches;
+  std::string tree, cut;
+  std::array<std::string,2> compress;
+  std::string auto_flush;
+  std::vector<std::array<std::string,2>> baskets;
+
+  ivanp::po::program_options& add(ivanp::po::program_options& po) {
+    return po
+      (branches,'b',"branches")
+      (cut,"--cut","C++ expression of branch variables selecting entries,\n"
+       "named as the output branches, or else as the input ones\n"
+       "e.g. 'njets>1 && jet_pt[0]>30'")
+      (compress,"--compress","output compression algorithm and level\n"
+       "zlib, lzma, lz4 or zstd, e.g. zstd:5")
+      (auto_flush,"--auto-flush","entries per output cluster,\n"
+       "or compressed bytes with k, M or G suffix")
+      (baskets,"--basket","[regex:]size of output baskets\n"
+       "bytes with k or M suffix, or auto to hold a cluster\n"
+       "estimated from the input branch sizes");
+  }
+
+  out_settings settings() {
+    out_settings out;
+    if (!compress[0].empty()) {
+      std::tie(out.algorithm,out.level) = compression(compress[0]);
+      if (!compress[1].empty()) out.level = std::stoi(compress[1]);
+    }
+    if (!auto_flush.empty()) {
+      out.auto_flush = parse_size(auto_flush);
+      if (!isdigit(auto_flush.back())) out.auto_flush = -out.auto_flush;
+    }
+    for (auto& opt : baskets) // size for all branches if without regex
+      if (opt[1].empty()) std::swap(opt[0],opt[1]), opt[0] = ".*";
+    if (cut.find_first_not_of(" \t")==std::string::npos) cut.clear();
+    if (branches.empty()) branches.emplace_back(".*","");
+    return out;
+  }
+};
+
 int main(int argc, char* argv[]) {
   std::vector<const char*> ifnames;
   const char *ofname = nullptr;
   std::array<std::string,2> tree_opt;
-  std::vector<std::pair<sed_opt,std::string>> branches;
-  bool compile = false, no_chain = false;
+  bool compile = false, no_chain = false, mt = false, bulk = false;
+  std::string cache_opt;
+  std::vector<output_opts> out_opts(1);
+
+  // arguments after each + describe another output
+  std::vector<int> groups { 0 };
+  for (int i=1; i<argc; ++i)
+    if (!strcmp(argv[i],"+")) groups.push_back(i);
+  groups.push_back(argc);
 
   try {
     using namespace ivanp::po;
-    if (program_options()
+    program_options po;
+    out_opts.front().add(po
       (ifnames,'i',"input files",req(),pos())
       (ofname,'o',"output file",req())
       (tree_opt,'t',"tree name")
-      (branches,'b',"branches")
       (compile,'c',"compile generated code")
       (no_chain,"--no-chain","use TTree instead of TChain for input")
-      .parse(argc,argv,true)) return 0;
+      (mt,"--mt","generate multithreaded RDataFrame code")
+      (bulk,"--bulk","read whole baskets of fixed size branches\n"
+       "of fundamental types with the bulk API")
+      (cache_opt,"--cache","TTreeCache size for the selected branches\n"
+       "bytes with k, M or G suffix, or auto to hold a cluster;\n"
+       "baskets are unzipped in parallel and next files opened ahead"));
+    if (po.parse(groups[1],argv,true)) {
+      cout << "\nArguments after each + describe another output,\n"
+              "with -t output tree name, -b, --cut, --compress,\n"
+              "--auto-flush and --basket" << endl;
+      return 0;
+    }
+    if (mt && bulk) throw std::runtime_error(
+      "--bulk cannot be used with --mt");
+    if (mt && !cache_opt.empty()) throw std::runtime_error(
+      "--cache cannot be used with --mt, RDataFrame sets up its own cache");
+
+    for (size_t g=1; g+1<groups.size(); ++g) {
+      out_opts.emplace_back();
+      program_options po;
+      out_opts.back().add(po
+        (out_opts.back().tree,'t',"output tree name"));
+      // the + takes the place of the program name
+      if (po.parse(groups[g+1]-groups[g],argv+groups[g])) return 0;
+    }
   } catch (const std::exception& e) {
     cerr <<"\033[31m"<< e.what() <<"\033[0m"<< endl;
     return 1;
@@ -106,125 +1127,136 @@ int main(int argc, char* argv[]) {
 
   cout << "\033[34mInput TTree\033[0m: " << tree_opt[0] << endl;
 
-  std::ofstream code(ofname);
-  code <<
-    "#include <iostream>\n"
-    "#include <iomanip>\n"
-    "#include <vector>\n\n"
-    "#include <TFile.h>\n"
-    "#include <" << (no_chain ? "TTree" : "TChain") << ".h>\n\n"
-    "using namespace std;\n\n"
-    "int main(int argc, char* argv[]) {\n";
+  out_opts.front().tree = tree_opt[!tree_opt[1].empty()];
+  std::vector<output_def> outs;
 
-  if (!no_chain) { code <<
-    "  if (argc<3) {\n"
-    "    cout << \"usage: \" << argv[0]"
-    " << \" out.root in.root ...\" << endl;\n"
-    "    return 1;\n  }\n\n"
+  std::ofstream code(ofname);
+  try {
+    for (auto& opts : out_opts) {
+      const out_settings settings = opts.settings();
+      outs.push_back({ opts.tree, opts.cut, settings, { } });
+      auto& out = outs.back();
+      if (out.tree.empty()) out.tree = tree_opt[0];
+      auto& defs = out.defs;
 
-    "  TChain tin(\"" << tree_opt[0] << "\");\n"
-    "  cout << \"Input files:\" << endl;\n"
-    "  for (int i=2; i<argc; ++i) {\n"
-    "    cout <<\"  \"<< argv[i] << endl;\n"
-    "    if (!tin.Add(argv[i],0)) return 1;\n"
-    "  }\n\n";
-  } else { code <<
-    "  if (argc!=3) {\n"
-    "    cout << \"usage: \" << argv[0] << \" out.root in.root\" << endl;\n"
-    "    return 1;\n  }\n\n"
+      // Match a branch by its dotted name, or else its members
+      // if it's a split object, which are then read separately
+      auto select = [&](
+        const std::vector<std::pair<sed_opt,std::string>>& match,
+        std::vector<branch_def>& selected
+      ) {
+        std::function<void(TBranch*,const std::string&,bool)> walk =
+        [&](TBranch* b, const std::string& name, bool member) {
+          for (const auto& opt : match) if (opt.first==name) {
+            branch_def def;
+            def.in = b->GetName();
+            // members of objects split without a trailing dot in the branch
+            // name have only the member name, read the first of them by name
+            if (member && tree->GetBranch(def.in.c_str())!=b)
+              throw std::runtime_error(cat("member ",name," is in branch ",
+                def.in,", whose name is not unique in the tree, "
+                "so it cannot be read by name"));
+            def.out = opt.first.subst(name);
+            def.var = var_name(def.out);
 
-    "  TFile fin(argv[2]);\n"
-    "  if (fin.IsZombie()) return 1;\n"
-    "  TTree& tin = *dynamic_cast<TTree*>("
-    "fin.Get(\"" << tree_opt[0] << "\"));\n\n";
-  }
+            // class name of a member branch is that of the containing object
+            def.type = { member ? "" : b->GetClassName(), {} };
+            def.multi_leaf = false;
+            def.bulk_n = 0;
+            def.b = b;
+            def.basket = 0;
+            def.member = member;
 
-  code <<
-    "  TFile fout(argv[1],\"recreate\");\n"
-    "  if (fout.IsZombie()) return 1;\n"
-    "  TTree tout(\"" << tree_opt[!tree_opt[1].empty()] << "\",\"\");\n\n"
+            if (def.type[0].empty()) {
+              TObjArray *leaves = b->GetListOfLeaves();
+              if (b->GetNleaves()==1) {
+                def.type = leaf_type(static_cast<TLeaf*>(leaves->First()));
+                if (!member) def.bulk_n = fixed_size(def.type[1]);
+              } else {
+                std::stringstream ss;
+                ss << "struct { ";
+                for (auto* _l : *leaves) {
+                  TLeaf *l = static_cast<TLeaf*>(_l);
+                  const auto type = leaf_type(l);
+                  ss << type[0] << ' ' << l->GetName() << type[1] << "; ";
+                }
+                ss << '}';
+                def.type[0] = ss.str();
+                def.multi_leaf = true;
+              }
+            }
+            if (!opt.second.empty() && def.type[0]!=opt.second)
+              def.out_type = opt.second;
 
-    "  tin.SetBranchStatus(\"*\",0);\n"
-    "  auto in = [&](const char* name, auto* x){\n"
-    "    tin.SetBranchStatus(name,1);\n"
-    "    tin.SetBranchAddress(name,x);\n"
-    "  };\n"
-    << endl;
-
-  std::vector<std::string> branches_cp;
-  // std::map<std::string,std::vector<string>,std::less<void>> branches_used;
-
-  for (auto* _b : *tree->GetListOfBranches()) {
-    TBranch *b = static_cast<TBranch*>(_b);
-
-    const char* name1 = b->GetName();
+            selected.push_back(std::move(def));
+            return;
+          }
 
-    if (branches.empty()) branches.emplace_back(".*","");
-    for (const auto& opt : branches) if (opt.first==name1) {
-      std::string name2 = opt.first.subst(name1);
-
-      std::string name3 = name2;
-      for (char& c : name3)
-        if (!isalnum(c) && c!='_') c = '_';
-
-      std::array<std::string,2> type { b->GetClassName(), {} };
-
-      if (type[0].empty()) {
-        TObjArray *leaves = b->GetListOfLeaves();
-        if (b->GetNleaves()==1) {
-          type = leaf_type(static_cast<TLeaf*>(leaves->First()));
-        } else {
-          std::stringstream ss;
-          ss << "struct { ";
-          for (auto* _l : *leaves) {
-            TLeaf *l = static_cast<TLeaf*>(_l);
-            const auto type = leaf_type(l);
-            ss << type[0] << ' ' << l->GetName() << type[1] << "; ";
+          // members of collections are variable size arrays, read them whole
+          const auto* be = dynamic_cast<TBranchElement*>(b);
+          if (!be || be->GetType()==3 || be->GetType()==4) return;
+          std::string prefix = name;
+          if (prefix.back()=='.') prefix.pop_back();
+          prefix += '.';
+          for (auto* _s : *b->GetListOfBranches()) {
+            TBranch *s = static_cast<TBranch*>(_s);
+            std::string sname = s->GetName();
+            if (sname.compare(0,prefix.size(),prefix)) sname = prefix + sname;
+            walk(s,sname,true);
           }
-          ss << '}';
-          type[0] = ss.str();
+        };
+        for (auto* b : *tree->GetListOfBranches())
+          walk(static_cast<TBranch*>(b),b->GetName(),false);
+      };
+      select(opts.branches,defs);
+
+      // other branches used by the cut, named as the input branches
+      if (!out.cut.empty()) {
+        std::string ids; // regex of their dotted names
+        const boost::regex id("(?<![\\w.])[A-Za-z_]\\w*");
+        for (boost::sregex_iterator it(out.cut.begin(),out.cut.end(),id), end;
+             it!=end; ++it) {
+          const std::string var = it->str();
+          if (std::any_of(defs.begin(),defs.end(),
+              [&](const branch_def& b){ return b.var==var; })) continue;
+          if (!ids.empty()) ids += '|';
+          for (char c : var) // any character that var_name() replaces
+            if (c=='_') ids += "[^A-Za-z0-9]"; else ids += c;
         }
+        if (!ids.empty()) select({{ sed_opt(ids), {} }},out.cut_defs);
+        auto& cut_defs = out.cut_defs;
+        for (auto it=cut_defs.begin(); it!=cut_defs.end(); ) // one per variable
+          if (std::any_of(cut_defs.begin(),it,
+              [&](const branch_def& b){ return b.var==it->var; }))
+            it = cut_defs.erase(it);
+          else { it->out = it->in; ++it; } // column for RDataFrame
       }
-      const bool change_type = !opt.second.empty() && type[0]!=opt.second;
-      if (change_type)
-        code << "  " << type[0] << ' ' << name3 << "__in" << type[1] << ";\n";
-      code << "  " << (change_type?opt.second:type[0])
-           << ' ' << name3 << type[1] << ";\n"
-              "  in(\"" << name1 << "\",&"
-           << name3 << (change_type?"__in":"") << ");\n"
-              "  tout.Branch(\"" << name2 << "\",&" << name3 << ");\n";
 
-      if (change_type)
-        branches_cp.emplace_back(std::move(name3));
-
-      // if (branches_used.find(name1)==branches_used.end())
-      //   branches_used.emplace(std::piecewise_construct,
-      //       name1, std::forward_as_tuple());
-
-      break;
+      const Long64_t cluster = cluster_entries(defs,out.settings.auto_flush);
+      for (auto& def : defs)
+        for (const auto& opt : opts.baskets) if (sed_opt(opt[0])==def.out) {
+          def.basket = opt[1]=="auto"
+            ? auto_basket(def.b,cluster) : parse_size(opt[1]);
+          break;
+        }
     }
-  }
 
-  code << "\n"
-    "  unsigned percent = 0;\n"
-    "  auto nent = tin.GetEntries();\n"
-    "  cout << \"  0%\\b\\b\\b\\b\" << flush;\n"
-    "  for (decltype(nent) ent=0; ent<nent; ++ent) {\n"
-    "    tin.GetEntry(ent);\n"
-    "    if (percent < (100.*ent/nent))\n"
-    "      cout << setw(3) << ++percent << \"%\\b\\b\\b\\b\" << flush;\n";
-
-  if (!branches_cp.empty()) code << '\n';
-  for (auto& name : branches_cp)
-    code << "    " << name << " = " << name << "__in;\n";
-
-  code << "\n"
-    "    tout.Fill();\n"
-    "  }\n"
-    "  cout << \"100%\" << endl;\n"
-    "  fout.Write(0,TObject::kOverwrite);\n"
-    "}" << endl;
+    std::vector<branch_def> all; // read by the program
+    for (const auto* b : inputs(outs)) all.push_back(*b);
+    if (!mt && std::any_of(all.begin(),all.end(),
+          [](const branch_def& b){ return b.member; }))
+      for (const auto& b : all) if (split_object(b))
+        throw std::runtime_error(cat("split object ",b.in," cannot be read "
+          "whole together with members of split objects; select its members"));
+    const Long64_t cache = cache_opt.empty() ? 0
+      : cache_opt=="auto" ? auto_cache(tree,all) : parse_size(cache_opt);
 
+    if (mt) write_mt(code,outs,tree_opt[0],no_chain);
+    else write_serial(code,outs,tree_opt[0],no_chain,bulk,cache);
+  } catch (const std::exception& e) {
+    cerr <<"\033[31m"<< e.what() <<"\033[0m"<< endl;
+    return 1;
+  }
   code.close();
 
   if (compile) {